@@ -0,0 +1,217 @@
+#ifndef _BENCHMARK_UTIL_HPP_
+#define _BENCHMARK_UTIL_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "intrinsics.hpp"
+
+// Traces are stored as CSV with this header and one row per sample. Rows of one
+// run are contiguous and ordered by time. See benchmarks/baseline.csv.
+const char kBenchmarkTraceHeader[] = "image,seed,seconds,iterations,fitness";
+
+struct BenchmarkSample
+{
+	double seconds;
+	long long iterations;
+	double fitness;
+};
+
+// One run of the optimizer on one image with one seed.
+struct BenchmarkRun
+{
+	BenchmarkRun() : seed(0) {}
+
+	std::string image;
+	unsigned int seed;
+	std::vector<BenchmarkSample> samples;
+};
+
+// Seconds until the fitness first reached |target|, -1 if it never did.
+inline
+double TimeToTarget(const std::vector<BenchmarkSample> &samples, double target) {
+	for (size_t i = 0; i < samples.size(); ++i) {
+		if (samples[i].fitness <= target)
+			return samples[i].seconds;
+	}
+	return -1;
+}
+
+// The last sample taken at or before |seconds|.
+inline
+BenchmarkSample SampleAt(const std::vector<BenchmarkSample> &samples, double seconds) {
+	BenchmarkSample sample = {};
+	for (size_t i = 0; i < samples.size() && samples[i].seconds <= seconds; ++i) {
+		sample = samples[i];
+	}
+	return sample;
+}
+
+inline
+double Mean(const std::vector<double> &values) {
+	double sum = 0;
+	for (size_t i = 0; i < values.size(); ++i) {
+		sum += values[i];
+	}
+	return values.empty() ? 0 : sum / values.size();
+}
+
+inline
+double Median(std::vector<double> values) {
+	if (values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	size_t mid = values.size() / 2;
+	return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+// Unbiased sample variance.
+inline
+double Variance(const std::vector<double> &values) {
+	if (values.size() < 2)
+		return 0;
+
+	double mean = Mean(values);
+	double sum = 0;
+	for (size_t i = 0; i < values.size(); ++i) {
+		sum += (values[i] - mean) * (values[i] - mean);
+	}
+	return sum / (values.size() - 1);
+}
+
+// Continued fraction for the incomplete beta function, see Numerical Recipes 6.4.
+inline
+double BetaContinuedFraction(double a, double b, double x) {
+	const double kEpsilon = 1e-12;
+	const double kTiny = 1e-300;
+
+	double c = 1;
+	double d = 1 - (a + b) * x / (a + 1);
+	if (fabs(d) < kTiny)
+		d = kTiny;
+	d = 1 / d;
+	double h = d;
+	for (int m = 1; m <= 200; ++m) {
+		double m2 = 2 * m;
+		double aa = m * (b - m) * x / ((a + m2 - 1) * (a + m2));
+		d = 1 + aa * d;
+		if (fabs(d) < kTiny)
+			d = kTiny;
+		c = 1 + aa / c;
+		if (fabs(c) < kTiny)
+			c = kTiny;
+		d = 1 / d;
+		h *= d * c;
+
+		aa = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1));
+		d = 1 + aa * d;
+		if (fabs(d) < kTiny)
+			d = kTiny;
+		c = 1 + aa / c;
+		if (fabs(c) < kTiny)
+			c = kTiny;
+		d = 1 / d;
+		double delta = d * c;
+		h *= delta;
+		if (fabs(delta - 1) < kEpsilon)
+			break;
+	}
+	return h;
+}
+
+inline
+double RegularizedIncompleteBeta(double a, double b, double x) {
+	if (x <= 0)
+		return 0;
+	if (x >= 1)
+		return 1;
+
+	double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+	if (x < (a + 1) / (a + b + 2))
+		return front * BetaContinuedFraction(a, b, x) / a;
+	return 1 - front * BetaContinuedFraction(b, a, 1 - x) / b;
+}
+
+// Two sided p-value of Welch's t-test that |a| and |b| have the same mean.
+inline
+double WelchTTest(const std::vector<double> &a, const std::vector<double> &b) {
+	if (a.size() < 2 || b.size() < 2)
+		return 1;
+
+	double va = Variance(a) / a.size();
+	double vb = Variance(b) / b.size();
+	double diff = Mean(a) - Mean(b);
+	if (va + vb == 0)
+		return diff == 0 ? 1 : 0;
+
+	double t = diff / sqrt(va + vb);
+	double dof = (va + vb) * (va + vb) / (va * va / (a.size() - 1) + vb * vb / (b.size() - 1));
+	return RegularizedIncompleteBeta(dof / 2, 0.5, dof / (dof + t * t));
+}
+
+inline
+bool SaveBenchmarkTraces(const std::string &filename, const std::vector<BenchmarkRun> &runs) {
+	FILE *out = fopen(filename.c_str(), "w");
+	if (!out) {
+		LOG("Unable to open %s\n", filename.c_str());
+		return false;
+	}
+
+	fprintf(out, "%s\n", kBenchmarkTraceHeader);
+	for (size_t i = 0; i < runs.size(); ++i) {
+		const BenchmarkRun &run = runs[i];
+		for (size_t j = 0; j < run.samples.size(); ++j) {
+			const BenchmarkSample &sample = run.samples[j];
+			fprintf(out, "%s,%u,%f,%lld,%.9f\n", run.image.c_str(), run.seed, sample.seconds,
+				sample.iterations, sample.fitness);
+		}
+	}
+
+	fclose(out);
+	return true;
+}
+
+// Reads traces written by SaveBenchmarkTraces, so old runs can serve as a baseline.
+inline
+bool LoadBenchmarkTraces(const std::string &filename, std::vector<BenchmarkRun> *runs) {
+	FILE *in = fopen(filename.c_str(), "r");
+	if (!in) {
+		LOG("Unable to open %s\n", filename.c_str());
+		return false;
+	}
+
+	char header[256];
+	if (!fgets(header, sizeof(header), in) ||
+		strncmp(header, kBenchmarkTraceHeader, strlen(kBenchmarkTraceHeader)) != 0) {
+		LOG("%s is not a benchmark trace\n", filename.c_str());
+		fclose(in);
+		return false;
+	}
+
+	char image[1024];
+	unsigned int seed;
+	BenchmarkSample sample;
+	int fields;
+	while ((fields = fscanf(in, " %1023[^,],%u,%lf,%lld,%lf", image, &seed, &sample.seconds,
+		&sample.iterations, &sample.fitness)) == 5) {
+		if (runs->empty() || runs->back().image != image || runs->back().seed != seed) {
+			runs->push_back(BenchmarkRun());
+			runs->back().image = image;
+			runs->back().seed = seed;
+		}
+		runs->back().samples.push_back(sample);
+	}
+
+	fclose(in);
+	if (fields != EOF) {
+		LOG("Malformed row in %s\n", filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+#endif
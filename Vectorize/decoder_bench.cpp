@@ -0,0 +1,69 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "gene_codec.hpp"
+#include "gene_raster.hpp"
+
+using namespace std;
+
+// Measures how many times per second an encoded gene can be
+// decoded and rendered at a given output resolution.
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: decoder_bench gene.vgz [width height] [seconds]\n");
+		return EXIT_FAILURE;
+	}
+
+	ifstream file(argv[1], ios::binary);
+	if (!file.is_open()) {
+		fprintf(stderr, "Unable to open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	vector<uint8_t> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+	unsigned int width, height;
+	int polygon_count;
+	Poly *gene;
+	if (!DecodeGene(data.data(), data.size(), &width, &height, &polygon_count, &gene)) {
+		fprintf(stderr, "Failed to decode %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	delete[] gene;
+
+	if (argc >= 4) {
+		width = atoi(argv[2]);
+		height = atoi(argv[3]);
+	}
+	double seconds = argc >= 5 ? atof(argv[4]) : 5.0;
+	if (!IsValidRasterSize(width, height)) {
+		fprintf(stderr, "Invalid output size %ux%u, at most %u per side\n", width, height, kMaxRasterSize);
+		return EXIT_FAILURE;
+	}
+
+	vector<uint8_t> rgba(static_cast<size_t>(width) * height * 4);
+
+	int decodes = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	double elapsed = 0;
+	while (elapsed < seconds) {
+		unsigned int gene_width, gene_height;
+		if (!DecodeGene(data.data(), data.size(), &gene_width, &gene_height, &polygon_count, &gene)) {
+			fprintf(stderr, "Failed to decode %s\n", argv[1]);
+			return EXIT_FAILURE;
+		}
+		RenderGeneRGBA(gene, polygon_count, width, height, rgba.data());
+		delete[] gene;
+
+		decodes += 1;
+		elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	printf("%d polygons, %zu bytes, %ux%u: %.1f decodes/sec\n", polygon_count, data.size(),
+		width, height, decodes / elapsed);
+	return EXIT_SUCCESS;
+}
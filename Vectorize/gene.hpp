@@ -0,0 +1,130 @@
+#ifndef _GENE_HPP_
+#define _GENE_HPP_
+
+#include <cstddef>
+#include <utility>
+
+struct Colour
+{
+	float r, g, b, a;
+};
+
+struct Vertex
+{
+	float x, y;
+};
+
+struct Poly
+{
+	Poly() : colour({}), vertex_count(0), vertices(NULL),
+		triangulated(false), triangle_count(0), triangles(NULL),
+		triangle_vertices(NULL), area(0) {}
+
+	~Poly() {
+		if (vertices)
+			delete[] vertices;
+		if (triangles)
+			delete[] triangles;
+		if (triangle_vertices)
+			delete[] triangle_vertices;
+	}
+
+	Colour colour;
+
+	int vertex_count;
+	Vertex *vertices;
+
+	// Triangulation of |vertices| cached by Triangulate(), see triangulate.hpp.
+	// Anything which changes |vertices| must call InvalidateTriangulation().
+	mutable bool triangulated;
+	mutable int triangle_count;
+	mutable Vertex *triangles;
+	// Index into |vertices| of each corner of |triangles|.
+	mutable int *triangle_vertices;
+	mutable float area;
+	mutable Vertex min, max;
+};
+
+inline
+void InvalidateTriangulation(Poly &polygon) {
+	polygon.triangulated = false;
+}
+
+inline
+void CopyVertex(Vertex &v1, const Vertex &v2) {
+	v1.x = v2.x;
+	v1.y = v2.y;
+}
+
+inline
+void CopyVertices(Vertex *v1, const Vertex *v2, int num) {
+	for (int i = 0; i < num; ++i) {
+		CopyVertex(v1[i], v2[i]);
+	}
+}
+
+inline
+void CopyPolygon(Poly &p1, const Poly &p2) {
+	p1.colour.r = p2.colour.r;
+	p1.colour.g = p2.colour.g;
+	p1.colour.b = p2.colour.b;
+	p1.colour.a = p2.colour.a;
+
+	if (p1.vertices)
+		delete[] p1.vertices;
+
+	p1.vertex_count = p2.vertex_count;
+	p1.vertices = p2.vertices ? new Vertex[p2.vertex_count] : NULL;
+
+	CopyVertices(p1.vertices, p2.vertices, p2.vertex_count);
+
+	if (p1.triangles)
+		delete[] p1.triangles;
+
+	p1.triangulated = p2.triangulated;
+	p1.triangle_count = p2.triangulated ? p2.triangle_count : 0;
+	p1.triangles = p1.triangle_count > 0 ? new Vertex[p1.triangle_count * 3] : NULL;
+	CopyVertices(p1.triangles, p2.triangles, p1.triangle_count * 3);
+
+	if (p1.triangle_vertices)
+		delete[] p1.triangle_vertices;
+
+	p1.triangle_vertices = p1.triangle_count > 0 ? new int[p1.triangle_count * 3] : NULL;
+	for (int i = 0; i < p1.triangle_count * 3; ++i) {
+		p1.triangle_vertices[i] = p2.triangle_vertices[i];
+	}
+	p1.area = p2.area;
+	p1.min = p2.min;
+	p1.max = p2.max;
+}
+
+// Moves |p2| into an empty |p1| without copying its vertices, leaving |p2| empty.
+inline
+void MovePolygon(Poly &p1, Poly &p2) {
+	std::swap(p1.colour, p2.colour);
+	std::swap(p1.vertex_count, p2.vertex_count);
+	std::swap(p1.vertices, p2.vertices);
+	std::swap(p1.triangulated, p2.triangulated);
+	std::swap(p1.triangle_count, p2.triangle_count);
+	std::swap(p1.triangles, p2.triangles);
+	std::swap(p1.triangle_vertices, p2.triangle_vertices);
+	std::swap(p1.area, p2.area);
+	std::swap(p1.min, p2.min);
+	std::swap(p1.max, p2.max);
+}
+
+inline
+void MovePolygons(Poly *p1, Poly *p2, int num) {
+	for (int i = 0; i < num; ++i) {
+		MovePolygon(p1[i], p2[i]);
+	}
+}
+
+inline
+void CopyPolygons(Poly *p1, const Poly *p2, int num) {
+	for (int i = 0; i < num; ++i) {
+		CopyPolygon(p1[i], p2[i]);
+	}
+}
+
+#endif
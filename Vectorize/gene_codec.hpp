@@ -0,0 +1,280 @@
+#ifndef _GENE_CODEC_HPP_
+#define _GENE_CODEC_HPP_
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "gene.hpp"
+
+// Compact binary gene format:
+//
+//   'V' 'Z' version flags vertex_bits
+//   varint width, varint height, varint polygon_count
+//   per polygon:
+//     r g b a (8 bits each), varint vertex_count
+//     vertices quantized to |vertex_bits| bits, either bit packed
+//     or, with kGeneFlagDelta, zigzag varint deltas from the previous vertex.
+//
+// Bit packed vertices are padded to a byte boundary at the end of each polygon.
+//
+// Version 2 vertices are polygon outlines (see triangulate.hpp), whereas
+// version 1 vertices were triangle strips.
+
+const uint8_t kGeneVersion = 2;
+const uint8_t kGeneFlagDelta = 1 << 0;
+
+const int kMinVertexBits = 12;
+const int kMaxVertexBits = 16;
+
+// Colour and a one byte vertex count, used to reject counts the data can't hold.
+const size_t kMinPolygonBytes = 5;
+
+struct GeneEncoding
+{
+	GeneEncoding() : vertex_bits(kMinVertexBits), delta(false) {}
+
+	int vertex_bits;
+	bool delta;
+};
+
+inline
+uint32_t QuantizeUnit(float value, int bits) {
+	uint32_t max = (1u << bits) - 1;
+	float scaled = std::floor(value * max + 0.5f);
+	return scaled <= 0 ? 0 : scaled >= max ? max : static_cast<uint32_t>(scaled);
+}
+
+inline
+float DequantizeUnit(uint32_t value, int bits) {
+	return static_cast<float>(value) / ((1u << bits) - 1);
+}
+
+// Snaps the gene onto the values representable by |encoding|
+// so it can be scored exactly as it will be decoded.
+inline
+void QuantizeGene(Poly *gene, int polygon_count, const GeneEncoding &encoding) {
+	for (int i = 0; i < polygon_count; ++i) {
+		Poly &polygon = gene[i];
+		polygon.colour.r = DequantizeUnit(QuantizeUnit(polygon.colour.r, 8), 8);
+		polygon.colour.g = DequantizeUnit(QuantizeUnit(polygon.colour.g, 8), 8);
+		polygon.colour.b = DequantizeUnit(QuantizeUnit(polygon.colour.b, 8), 8);
+		polygon.colour.a = DequantizeUnit(QuantizeUnit(polygon.colour.a, 8), 8);
+		bool moved = false;
+		for (int j = 0; j < polygon.vertex_count; ++j) {
+			Vertex &vertex = polygon.vertices[j];
+			float x = DequantizeUnit(QuantizeUnit(vertex.x, encoding.vertex_bits), encoding.vertex_bits);
+			float y = DequantizeUnit(QuantizeUnit(vertex.y, encoding.vertex_bits), encoding.vertex_bits);
+			moved |= x != vertex.x || y != vertex.y;
+			vertex.x = x;
+			vertex.y = y;
+		}
+		if (moved)
+			InvalidateTriangulation(polygon);
+	}
+}
+
+inline
+void WriteVarint(uint32_t value, std::vector<uint8_t> *out) {
+	while (value >= 0x80) {
+		out->push_back(static_cast<uint8_t>(value | 0x80));
+		value >>= 7;
+	}
+	out->push_back(static_cast<uint8_t>(value));
+}
+
+inline
+bool ReadVarint(const uint8_t *data, size_t size, size_t *offset, uint32_t *value) {
+	*value = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (*offset >= size)
+			return false;
+
+		uint8_t byte = data[(*offset)++];
+		*value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+inline
+uint32_t ZigZag(int32_t value) {
+	return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+inline
+int32_t UnZigZag(uint32_t value) {
+	return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+struct BitWriter
+{
+	BitWriter(std::vector<uint8_t> *out) : out(out), bits(0), bit_count(0) {}
+
+	std::vector<uint8_t> *out;
+	uint32_t bits;
+	int bit_count;
+};
+
+inline
+void WriteBits(BitWriter *writer, uint32_t value, int count) {
+	writer->bits = (writer->bits << count) | value;
+	writer->bit_count += count;
+	while (writer->bit_count >= 8) {
+		writer->bit_count -= 8;
+		writer->out->push_back(static_cast<uint8_t>(writer->bits >> writer->bit_count));
+	}
+	writer->bits &= (1u << writer->bit_count) - 1;
+}
+
+inline
+void FlushBits(BitWriter *writer) {
+	if (writer->bit_count > 0)
+		WriteBits(writer, 0, 8 - writer->bit_count);
+}
+
+struct BitReader
+{
+	BitReader(const uint8_t *data, size_t size, size_t *offset)
+		: data(data), size(size), offset(offset), bits(0), bit_count(0) {}
+
+	const uint8_t *data;
+	size_t size;
+	size_t *offset;
+	uint32_t bits;
+	int bit_count;
+};
+
+inline
+bool ReadBits(BitReader *reader, int count, uint32_t *value) {
+	while (reader->bit_count < count) {
+		if (*reader->offset >= reader->size)
+			return false;
+		reader->bits = (reader->bits << 8) | reader->data[(*reader->offset)++];
+		reader->bit_count += 8;
+	}
+	reader->bit_count -= count;
+	*value = (reader->bits >> reader->bit_count) & ((1u << count) - 1);
+	reader->bits &= (1u << reader->bit_count) - 1;
+	return true;
+}
+
+inline
+void EncodeGene(const Poly *gene, int polygon_count, unsigned int width, unsigned int height,
+	            const GeneEncoding &encoding, std::vector<uint8_t> *out) {
+	out->push_back('V');
+	out->push_back('Z');
+	out->push_back(kGeneVersion);
+	out->push_back(encoding.delta ? kGeneFlagDelta : 0);
+	out->push_back(static_cast<uint8_t>(encoding.vertex_bits));
+	WriteVarint(width, out);
+	WriteVarint(height, out);
+	WriteVarint(polygon_count, out);
+
+	for (int i = 0; i < polygon_count; ++i) {
+		const Poly &polygon = gene[i];
+		out->push_back(static_cast<uint8_t>(QuantizeUnit(polygon.colour.r, 8)));
+		out->push_back(static_cast<uint8_t>(QuantizeUnit(polygon.colour.g, 8)));
+		out->push_back(static_cast<uint8_t>(QuantizeUnit(polygon.colour.b, 8)));
+		out->push_back(static_cast<uint8_t>(QuantizeUnit(polygon.colour.a, 8)));
+		WriteVarint(polygon.vertex_count, out);
+
+		BitWriter writer(out);
+		int32_t prev_x = 0, prev_y = 0;
+		for (int j = 0; j < polygon.vertex_count; ++j) {
+			int32_t x = QuantizeUnit(polygon.vertices[j].x, encoding.vertex_bits);
+			int32_t y = QuantizeUnit(polygon.vertices[j].y, encoding.vertex_bits);
+			if (encoding.delta) {
+				WriteVarint(ZigZag(x - prev_x), out);
+				WriteVarint(ZigZag(y - prev_y), out);
+				prev_x = x;
+				prev_y = y;
+			} else {
+				WriteBits(&writer, x, encoding.vertex_bits);
+				WriteBits(&writer, y, encoding.vertex_bits);
+			}
+		}
+		FlushBits(&writer);
+	}
+}
+
+// Decodes an encoded gene into a newly allocated array of |polygon_count| polygons.
+// Fails without allocating more than the data could describe on truncated or corrupt input.
+inline
+bool DecodeGene(const uint8_t *data, size_t size, unsigned int *width, unsigned int *height,
+	            int *polygon_count, Poly **gene) {
+	if (size < 5 || data[0] != 'V' || data[1] != 'Z' || data[2] != kGeneVersion)
+		return false;
+
+	bool delta = (data[3] & kGeneFlagDelta) != 0;
+	int vertex_bits = data[4];
+	if (vertex_bits < kMinVertexBits || vertex_bits > kMaxVertexBits)
+		return false;
+
+	size_t offset = 5;
+	uint32_t count;
+	if (!ReadVarint(data, size, &offset, width) ||
+		!ReadVarint(data, size, &offset, height) ||
+		!ReadVarint(data, size, &offset, &count)) {
+		return false;
+	}
+	if (count > (size - offset) / kMinPolygonBytes)
+		return false;
+
+	// Delta coded vertices take at least a byte per coordinate. Bit packed ones share bytes,
+	// so only their bits can be bounded.
+	size_t min_vertex_bits = delta ? 16 : 2 * vertex_bits;
+	int64_t max_coordinate = 1 << vertex_bits;
+
+	Poly *polygons = new Poly[count];
+	for (uint32_t i = 0; i < count; ++i) {
+		Poly &polygon = polygons[i];
+		uint32_t vertex_count;
+		if (offset + 4 > size) {
+			delete[] polygons;
+			return false;
+		}
+		polygon.colour.r = DequantizeUnit(data[offset++], 8);
+		polygon.colour.g = DequantizeUnit(data[offset++], 8);
+		polygon.colour.b = DequantizeUnit(data[offset++], 8);
+		polygon.colour.a = DequantizeUnit(data[offset++], 8);
+		if (!ReadVarint(data, size, &offset, &vertex_count) ||
+			vertex_count > (size - offset) * 8 / min_vertex_bits) {
+			delete[] polygons;
+			return false;
+		}
+
+		polygon.vertex_count = vertex_count;
+		polygon.vertices = new Vertex[vertex_count];
+
+		BitReader reader(data, size, &offset);
+		int64_t x = 0, y = 0;
+		for (uint32_t j = 0; j < vertex_count; ++j) {
+			bool ok;
+			if (delta) {
+				uint32_t dx, dy;
+				ok = ReadVarint(data, size, &offset, &dx) && ReadVarint(data, size, &offset, &dy);
+				x += UnZigZag(dx);
+				y += UnZigZag(dy);
+			} else {
+				uint32_t qx, qy;
+				ok = ReadBits(&reader, vertex_bits, &qx) && ReadBits(&reader, vertex_bits, &qy);
+				x = qx;
+				y = qy;
+			}
+			if (!ok || x < 0 || x >= max_coordinate || y < 0 || y >= max_coordinate) {
+				delete[] polygons;
+				return false;
+			}
+			polygon.vertices[j].x = DequantizeUnit(static_cast<uint32_t>(x), vertex_bits);
+			polygon.vertices[j].y = DequantizeUnit(static_cast<uint32_t>(y), vertex_bits);
+		}
+	}
+
+	*polygon_count = count;
+	*gene = polygons;
+	return true;
+}
+
+#endif
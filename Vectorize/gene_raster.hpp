@@ -0,0 +1,166 @@
+#ifndef _GENE_RASTER_HPP_
+#define _GENE_RASTER_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "gene.hpp"
+#include "triangulate.hpp"
+
+// CPU rasterizer for genes which doesn't need a GL context.
+//
+// It mirrors how the optimizer renders with GL so decoded genes look
+// the way they were scored: each polygon is drawn as its cached triangulation
+// over an opaque black background and every triangle is alpha blended into an 8 bit target.
+//
+// Output rows are stored top down, whereas gene coordinates have y pointing up.
+// Outputs can be rendered a band of rows at a time, so their size is unbounded.
+
+inline
+float EdgeFunction(float ax, float ay, float bx, float by, float px, float py) {
+	return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+// Top-left fill rule, so pixel centers on an edge shared by two triangles are only drawn once.
+inline
+bool IsTopLeftEdge(float ax, float ay, float bx, float by) {
+	return (ay == by && bx < ax) || by < ay;
+}
+
+inline
+bool InsideEdge(float ax, float ay, float bx, float by, float px, float py) {
+	float w = EdgeFunction(ax, ay, bx, by, px, py);
+	return w > 0 || (w == 0 && IsTopLeftEdge(ax, ay, bx, by));
+}
+
+inline
+uint8_t BlendChannel(uint8_t dst, float src, float alpha) {
+	float value = src * alpha + dst / 255.0f * (1.0f - alpha);
+	return static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, value * 255.0f + 0.5f)));
+}
+
+// Largest output width or height. Sizes are validated against it up front, so
+// pixel offsets can't overflow and float pixel coordinates keep sub-sample precision.
+const unsigned int kMaxRasterSize = 1 << 19;
+
+inline
+bool IsValidRasterSize(unsigned int width, unsigned int height) {
+	return width > 0 && height > 0 && width <= kMaxRasterSize && height <= kMaxRasterSize;
+}
+
+// Rows [y, y + rows) of a |width| x |height| output, with each pixel
+// sampled on a |samples| x |samples| grid for anti-aliasing.
+struct RasterBand
+{
+	int width;
+	int height;
+	int y;
+	int rows;
+	int samples;
+
+	// |width| x |rows| pixels, and the coverage of the polygon being drawn
+	// which must be zero between polygons.
+	uint8_t *rgba;
+	float *coverage;
+};
+
+// Adds the fraction of each pixel's samples inside the triangle to the band's coverage.
+inline
+void RasterizeTriangle(const Vertex &v0, const Vertex &v1, const Vertex &v2, const RasterBand &band) {
+	float x0 = v0.x * band.width, y0 = (1.0f - v0.y) * band.height;
+	float x1 = v1.x * band.width, y1 = (1.0f - v1.y) * band.height;
+	float x2 = v2.x * band.width, y2 = (1.0f - v2.y) * band.height;
+
+	// Flipping y reverses the winding, so triangles must be
+	// clockwise in gene space to have a positive area here.
+	float area = EdgeFunction(x0, y0, x1, y1, x2, y2);
+	if (area <= 0)
+		return;
+
+	int min_x = std::max(0, static_cast<int>(std::floor(std::min(x0, std::min(x1, x2)))));
+	int max_x = std::min(band.width - 1, static_cast<int>(std::ceil(std::max(x0, std::max(x1, x2)))));
+	int min_y = std::max(band.y, static_cast<int>(std::floor(std::min(y0, std::min(y1, y2)))));
+	int max_y = std::min(band.y + band.rows - 1, static_cast<int>(std::ceil(std::max(y0, std::max(y1, y2)))));
+
+	float weight = 1.0f / (band.samples * band.samples);
+	for (int y = min_y; y <= max_y; ++y) {
+		float *coverage = band.coverage + static_cast<size_t>(y - band.y) * band.width;
+		for (int x = min_x; x <= max_x; ++x) {
+			int inside = 0;
+			for (int sy = 0; sy < band.samples; ++sy) {
+				float py = y + (sy + 0.5f) / band.samples;
+				for (int sx = 0; sx < band.samples; ++sx) {
+					float px = x + (sx + 0.5f) / band.samples;
+					inside += InsideEdge(x1, y1, x2, y2, px, py) &&
+						InsideEdge(x2, y2, x0, y0, px, py) &&
+						InsideEdge(x0, y0, x1, y1, px, py);
+				}
+			}
+			coverage[x] += inside * weight;
+		}
+	}
+}
+
+// Blends the polygon into the band weighted by how much of each pixel it covers.
+inline
+void RasterizePolygon(const Poly &polygon, const RasterBand &band) {
+	Triangulate(polygon);
+	if (polygon.triangle_count == 0)
+		return;
+
+	int min_x = std::max(0, static_cast<int>(std::floor(polygon.min.x * band.width)));
+	int max_x = std::min(band.width - 1, static_cast<int>(std::ceil(polygon.max.x * band.width)));
+	int min_y = std::max(band.y, static_cast<int>(std::floor((1.0f - polygon.max.y) * band.height)));
+	int max_y = std::min(band.y + band.rows - 1, static_cast<int>(std::ceil((1.0f - polygon.min.y) * band.height)));
+	if (min_x > max_x || min_y > max_y)
+		return;
+
+	for (int i = 0; i < polygon.triangle_count; ++i) {
+		const Vertex *v = polygon.triangles + i * 3;
+		RasterizeTriangle(v[0], v[2], v[1], band);
+	}
+
+	const Colour &colour = polygon.colour;
+	for (int y = min_y; y <= max_y; ++y) {
+		size_t row = static_cast<size_t>(y - band.y) * band.width;
+		for (int x = min_x; x <= max_x; ++x) {
+			float &coverage = band.coverage[row + x];
+			if (coverage <= 0)
+				continue;
+
+			float alpha = colour.a * std::min(coverage, 1.0f);
+			uint8_t *pixel = band.rgba + (row + x) * 4;
+			pixel[0] = BlendChannel(pixel[0], colour.r, alpha);
+			pixel[1] = BlendChannel(pixel[1], colour.g, alpha);
+			pixel[2] = BlendChannel(pixel[2], colour.b, alpha);
+			coverage = 0;
+		}
+	}
+}
+
+// Renders the rows of |gene| covered by |band|.
+inline
+void RenderGeneBand(const Poly *gene, int polygon_count, const RasterBand &band) {
+	size_t pixels = static_cast<size_t>(band.width) * band.rows;
+	for (size_t i = 0; i < pixels; ++i) {
+		band.rgba[i * 4 + 0] = 0;
+		band.rgba[i * 4 + 1] = 0;
+		band.rgba[i * 4 + 2] = 0;
+		band.rgba[i * 4 + 3] = 255;
+	}
+	for (int i = 0; i < polygon_count; ++i) {
+		RasterizePolygon(gene[i], band);
+	}
+}
+
+// Renders |gene| into a |width| x |height| RGBA buffer with one sample per pixel.
+inline
+void RenderGeneRGBA(const Poly *gene, int polygon_count, int width, int height, uint8_t *rgba) {
+	std::vector<float> coverage(static_cast<size_t>(width) * height);
+	RasterBand band = { width, height, 0, height, 1, rgba, coverage.data() };
+	RenderGeneBand(gene, polygon_count, band);
+}
+
+#endif
@@ -10,6 +10,7 @@
 #include "intrinsics.hpp"
 
 // TODO(orglofch): Use vbo
+inline
 void glDrawRect(float left, float right, float bottom, float top, float depth) {
 	glBegin(GL_QUADS);
 		glTexCoord2f(0, 0); glVertex3f(left, bottom, depth);
@@ -19,6 +20,7 @@ void glDrawRect(float left, float right, float bottom, float top, float depth) {
 	glEnd();
 }
 
+inline
 void glCreateTexture2D(GLuint *texture, int width, int height, int channels, void *data) {
 	assert(data);
 
@@ -41,6 +43,26 @@ void glCreateTexture2D(GLuint *texture, int width, int height, int channels, voi
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+inline
+bool glCreateFramebuffer(GLuint *framebuffer, GLuint *colour_buffer, int width, int height) {
+	glGenFramebuffers(1, framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, *framebuffer);
+
+	glGenRenderbuffers(1, colour_buffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, *colour_buffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, *colour_buffer);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		LOG("Failed to create framebuffer %d\n", status);
+		return false;
+	}
+	return true;
+}
+
+inline
 void glSetPerspectiveProjection(const size_t width, 
 							    const size_t height, 
 								const GLdouble fov,
@@ -56,6 +78,7 @@ void glSetPerspectiveProjection(const size_t width,
 	glLoadIdentity();
 }
 
+inline
 void glSetOrthographicProjection(const GLdouble left, 
 							     const GLdouble right, 
 							     const GLdouble bottom, 
@@ -71,6 +94,7 @@ void glSetOrthographicProjection(const GLdouble left,
 	glLoadIdentity();
 }
 
+inline
 void glPrintShaderInfo(GLint shader) {
 	int info_log_len = 0;
 	int char_written = 0;
@@ -86,6 +110,7 @@ void glPrintShaderInfo(GLint shader) {
 	}
 }
 
+inline
 bool glLoadShader(const char *vs_filename,
 	              const char *fs_filename,
 	              GLuint &shader_program,
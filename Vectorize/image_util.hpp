@@ -27,6 +27,7 @@ struct Image
 	float *data;
 };
 
+inline
 bool LoadBMP(const std::string &filename, Image *image) {
 	unsigned char header[54];
 	unsigned int dataPos;
@@ -68,6 +69,7 @@ bool LoadBMP(const std::string &filename, Image *image) {
 	return true;
 }
 
+inline
 bool LoadPNG(const std::string &filename, Image *image) {
 	png_byte buf[8];
 
@@ -181,4 +183,85 @@ bool LoadPNG(const std::string &filename, Image *image) {
 	return true;
 }
 
+// Writes an 8 bit RGB PNG a few rows at a time.
+struct PNGWriter
+{
+	PNGWriter() : file(NULL), png_ptr(NULL), info_ptr(NULL), width(0) {}
+
+	~PNGWriter() {
+		if (png_ptr)
+			png_destroy_write_struct(&png_ptr, &info_ptr);
+		if (file)
+			fclose(file);
+	}
+
+	FILE *file;
+	png_structp png_ptr;
+	png_infop info_ptr;
+	unsigned int width;
+	std::vector<png_byte> row;
+};
+
+inline
+bool OpenPNGWriter(const std::string &filename, unsigned int width, unsigned int height, PNGWriter *writer) {
+	writer->file = fopen(filename.c_str(), "wb");
+	if (!writer->file) {
+		LOG("Unable to open %s\n", filename.c_str());
+		return false;
+	}
+
+	writer->png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+	if (!writer->png_ptr) {
+		LOG("Failed to acquire png_ptr %s\n", filename.c_str());
+		return false;
+	}
+	writer->info_ptr = png_create_info_struct(writer->png_ptr);
+	if (!writer->info_ptr) {
+		LOG("Failed to acquire info_ptr %s\n", filename.c_str());
+		return false;
+	}
+	if (setjmp(png_jmpbuf(writer->png_ptr))) {
+		LOG("Failed to write header %s\n", filename.c_str());
+		return false;
+	}
+
+	png_init_io(writer->png_ptr, writer->file);
+	png_set_IHDR(writer->png_ptr, writer->info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB,
+		PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(writer->png_ptr, writer->info_ptr);
+
+	writer->width = width;
+	writer->row.resize(width * 3);
+	return true;
+}
+
+// Appends |rows| top down rows of RGBA pixels, dropping alpha.
+inline
+bool WritePNGRows(PNGWriter *writer, const uint8_t *rgba, int rows) {
+	if (setjmp(png_jmpbuf(writer->png_ptr))) {
+		LOG("Failed to write rows\n");
+		return false;
+	}
+	for (int y = 0; y < rows; ++y) {
+		const uint8_t *src = rgba + static_cast<size_t>(y) * writer->width * 4;
+		for (unsigned int x = 0; x < writer->width; ++x) {
+			writer->row[x * 3 + 0] = src[x * 4 + 0];
+			writer->row[x * 3 + 1] = src[x * 4 + 1];
+			writer->row[x * 3 + 2] = src[x * 4 + 2];
+		}
+		png_write_row(writer->png_ptr, writer->row.data());
+	}
+	return true;
+}
+
+inline
+bool ClosePNGWriter(PNGWriter *writer) {
+	if (setjmp(png_jmpbuf(writer->png_ptr))) {
+		LOG("Failed to finish writing\n");
+		return false;
+	}
+	png_write_end(writer->png_ptr, NULL);
+	return true;
+}
+
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <string>
@@ -14,7 +15,7 @@
 // TODO(orglofch): Possible remove preprocessor error suppression
 
 #define __FILENAME__ (strrchr(__FILE__, '\\') ? strrchr(__FILE__, '\\') + 1 : __FILE__)
-#define LOG(fmt, ...) do { if (_DEBUG) { fprintf(stderr, "%s:%d: " fmt, __FILENAME__, __LINE__, __VA_ARGS__); } } while(0)
+#define LOG(fmt, ...) do { if (_DEBUG) { fprintf(stderr, "%s:%d: " fmt, __FILENAME__, __LINE__, ##__VA_ARGS__); } } while(0)
 
 inline
 std::string ReadFile(const char *filename) {
@@ -46,4 +47,11 @@ float Randf(float min, float max) {
 	return (max - min) * rand() / RAND_MAX + min;
 }
 
+// Like Randf but combines two calls to rand() since RAND_MAX may be as low as 32767.
+inline
+double Randd(double min, double max) {
+	double scale = RAND_MAX + 1.0;
+	return (max - min) * (rand() * scale + rand()) / (scale * scale) + min;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,162 @@
+#ifndef _POLYGON_INDEX_HPP_
+#define _POLYGON_INDEX_HPP_
+
+#include <algorithm>
+#include <vector>
+
+#include "tiled_image.hpp"
+
+// Uniform grid over the image binning polygons by their pixel bounds,
+// so rendering a region only has to visit the polygons which overlap it.
+//
+// Cells hold stable polygon ids rather than gene indices, so adding, removing or
+// reordering a polygon only touches the cells that polygon covers. Queries map the
+// ids back to gene indices and sort them, as polygons are blended in gene order.
+
+const int kPolygonIndexCellSize = 64;
+
+struct PolygonIndex
+{
+	PolygonIndex() : cell_size(kPolygonIndexCellSize), cells_x(0), cells_y(0) {}
+
+	int cell_size;
+	int cells_x;
+	int cells_y;
+
+	std::vector<std::vector<int>> cells;
+
+	// Id of the polygon at each gene index.
+	std::vector<int> ids;
+
+	// Gene index and the pixel bounds it was binned with for each id, -1 for unused ids.
+	std::vector<int> indices;
+	std::vector<Rect> bounds;
+	std::vector<int> free_ids;
+};
+
+inline
+void InitPolygonIndex(PolygonIndex *index, unsigned int width, unsigned int height) {
+	index->cells_x = (width + index->cell_size - 1) / index->cell_size;
+	index->cells_y = (height + index->cell_size - 1) / index->cell_size;
+	index->cells.assign(index->cells_x * index->cells_y, std::vector<int>());
+	index->ids.clear();
+	index->indices.clear();
+	index->bounds.clear();
+	index->free_ids.clear();
+}
+
+// Calls |fn| with every cell overlapped by |rect|.
+template <typename Fn>
+void ForEachIndexCell(PolygonIndex *index, const Rect &rect, Fn fn) {
+	if (IsEmpty(rect))
+		return;
+
+	int min_x = std::max(0, rect.left / index->cell_size);
+	int min_y = std::max(0, rect.bottom / index->cell_size);
+	int max_x = std::min(index->cells_x - 1, (rect.right - 1) / index->cell_size);
+	int max_y = std::min(index->cells_y - 1, (rect.top - 1) / index->cell_size);
+	for (int y = min_y; y <= max_y; ++y) {
+		for (int x = min_x; x <= max_x; ++x) {
+			fn(index->cells[y * index->cells_x + x]);
+		}
+	}
+}
+
+inline
+void BinPolygon(PolygonIndex *index, int id) {
+	ForEachIndexCell(index, index->bounds[id], [&](std::vector<int> &cell) {
+		cell.push_back(id);
+	});
+}
+
+inline
+void UnbinPolygon(PolygonIndex *index, int id) {
+	ForEachIndexCell(index, index->bounds[id], [&](std::vector<int> &cell) {
+		std::vector<int>::iterator it = std::find(cell.begin(), cell.end(), id);
+		if (it != cell.end()) {
+			*it = cell.back();
+			cell.pop_back();
+		}
+	});
+}
+
+inline
+void ClearPolygonIndex(PolygonIndex *index) {
+	for (size_t i = 0; i < index->cells.size(); ++i) {
+		index->cells[i].clear();
+	}
+	index->ids.clear();
+	index->indices.clear();
+	index->bounds.clear();
+	index->free_ids.clear();
+}
+
+// Adds a polygon to the end of the gene.
+inline
+void AppendPolygonIndex(PolygonIndex *index, const Rect &bounds) {
+	int id;
+	if (index->free_ids.empty()) {
+		id = static_cast<int>(index->indices.size());
+		index->indices.push_back(0);
+		index->bounds.push_back(bounds);
+	} else {
+		id = index->free_ids.back();
+		index->free_ids.pop_back();
+		index->bounds[id] = bounds;
+	}
+	index->indices[id] = static_cast<int>(index->ids.size());
+	index->ids.push_back(id);
+	BinPolygon(index, id);
+}
+
+// Removes a polygon, shifting every later polygon down by one.
+inline
+void RemovePolygonIndex(PolygonIndex *index, int polygon) {
+	int id = index->ids[polygon];
+	UnbinPolygon(index, id);
+	index->indices[id] = -1;
+	index->free_ids.push_back(id);
+
+	index->ids.erase(index->ids.begin() + polygon);
+	for (size_t i = polygon; i < index->ids.size(); ++i) {
+		index->indices[index->ids[i]] = static_cast<int>(i);
+	}
+}
+
+// Rebins a polygon whose geometry changed.
+inline
+void UpdatePolygonIndex(PolygonIndex *index, int polygon, const Rect &bounds) {
+	int id = index->ids[polygon];
+	const Rect &old_bounds = index->bounds[id];
+	if (old_bounds.left == bounds.left && old_bounds.bottom == bounds.bottom &&
+		old_bounds.right == bounds.right && old_bounds.top == bounds.top) {
+		return;
+	}
+	UnbinPolygon(index, id);
+	index->bounds[id] = bounds;
+	BinPolygon(index, id);
+}
+
+// Swaps the gene order of two polygons, which leaves their cells as they are.
+inline
+void SwapPolygonIndex(PolygonIndex *index, int polygon1, int polygon2) {
+	std::swap(index->ids[polygon1], index->ids[polygon2]);
+	index->indices[index->ids[polygon1]] = polygon1;
+	index->indices[index->ids[polygon2]] = polygon2;
+}
+
+// Indices of the polygons overlapping |rect| in gene order.
+inline
+void QueryPolygonIndex(PolygonIndex *index, const Rect &rect, std::vector<int> *polygons) {
+	polygons->clear();
+	ForEachIndexCell(index, rect, [&](std::vector<int> &cell) {
+		for (size_t i = 0; i < cell.size(); ++i) {
+			if (!IsEmpty(IntersectRect(index->bounds[cell[i]], rect)))
+				polygons->push_back(index->indices[cell[i]]);
+		}
+	});
+	std::sort(polygons->begin(), polygons->end());
+	polygons->erase(std::unique(polygons->begin(), polygons->end()), polygons->end());
+}
+
+#endif
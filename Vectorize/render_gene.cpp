@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gene_codec.hpp"
+#include "gene_raster.hpp"
+#include "image_util.hpp"
+
+using namespace std;
+
+const int kBandRows = 32;
+const int kDefaultSamples = 4;
+
+// Bands rendered per thread ahead of the writer, bounding memory to
+// kBandRows * width * (kBandsPerThread * threads) pixels.
+const int kBandsPerThread = 2;
+
+// Bands are rendered by any thread into a fixed set of slots
+// and handed to the writer in order.
+struct BandQueue
+{
+	BandQueue(int slots) : next_band(0), written_bands(0), done(slots, false) {}
+
+	mutex lock;
+	condition_variable cv;
+
+	int next_band;
+	int written_bands;
+	vector<bool> done;
+};
+
+void RenderWorker(BandQueue *queue, const Poly *gene, int polygon_count, int width, int height,
+	              int samples, vector<vector<uint8_t>> *slots) {
+	int slot_count = static_cast<int>(slots->size());
+	int band_count = (height + kBandRows - 1) / kBandRows;
+	vector<float> coverage(static_cast<size_t>(width) * kBandRows);
+
+	while (true) {
+		int band_index;
+		{
+			unique_lock<mutex> guard(queue->lock);
+			queue->cv.wait(guard, [&] {
+				return queue->next_band >= band_count || queue->next_band < queue->written_bands + slot_count;
+			});
+			if (queue->next_band >= band_count)
+				return;
+			band_index = queue->next_band++;
+		}
+
+		RasterBand band;
+		band.width = width;
+		band.height = height;
+		band.y = band_index * kBandRows;
+		band.rows = min(kBandRows, height - band.y);
+		band.samples = samples;
+		band.rgba = (*slots)[band_index % slot_count].data();
+		band.coverage = coverage.data();
+		RenderGeneBand(gene, polygon_count, band);
+
+		lock_guard<mutex> guard(queue->lock);
+		queue->done[band_index % slot_count] = true;
+		queue->cv.notify_all();
+	}
+}
+
+// Renders an encoded gene to a PNG of any size, a band of rows at a time across threads.
+int main(int argc, char **argv) {
+	vector<string> positional;
+	int samples = kDefaultSamples;
+	int threads = max(1u, thread::hardware_concurrency());
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--samples" && i + 1 < argc) {
+			samples = max(1, atoi(argv[++i]));
+		} else if (arg == "--threads" && i + 1 < argc) {
+			threads = max(1, atoi(argv[++i]));
+		} else {
+			positional.push_back(arg);
+		}
+	}
+	if (positional.size() != 2 && positional.size() != 4) {
+		fprintf(stderr, "Usage: render_gene gene.vgz output.png [width height] [--samples N] [--threads N]\n");
+		return EXIT_FAILURE;
+	}
+
+	ifstream file(positional[0].c_str(), ios::binary);
+	if (!file.is_open()) {
+		fprintf(stderr, "Unable to open %s\n", positional[0].c_str());
+		return EXIT_FAILURE;
+	}
+	vector<uint8_t> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+	unsigned int width, height;
+	int polygon_count;
+	Poly *gene;
+	if (!DecodeGene(data.data(), data.size(), &width, &height, &polygon_count, &gene)) {
+		fprintf(stderr, "Failed to decode %s\n", positional[0].c_str());
+		return EXIT_FAILURE;
+	}
+	if (positional.size() == 4) {
+		width = atoi(positional[2].c_str());
+		height = atoi(positional[3].c_str());
+	}
+	if (!IsValidRasterSize(width, height)) {
+		fprintf(stderr, "Invalid output size %ux%u, at most %u per side\n", width, height, kMaxRasterSize);
+		delete[] gene;
+		return EXIT_FAILURE;
+	}
+
+	// Triangulate up front so workers only ever read the gene.
+	for (int i = 0; i < polygon_count; ++i) {
+		Triangulate(gene[i]);
+	}
+
+	PNGWriter writer;
+	if (!OpenPNGWriter(positional[1], width, height, &writer)) {
+		fprintf(stderr, "Unable to write %s\n", positional[1].c_str());
+		delete[] gene;
+		return EXIT_FAILURE;
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	int slot_count = threads * kBandsPerThread;
+	vector<vector<uint8_t>> slots(slot_count, vector<uint8_t>(static_cast<size_t>(width) * kBandRows * 4));
+	BandQueue queue(slot_count);
+
+	vector<thread> workers;
+	for (int i = 0; i < threads; ++i) {
+		workers.push_back(thread(RenderWorker, &queue, gene, polygon_count, width, height, samples, &slots));
+	}
+
+	bool written = true;
+	int band_count = (height + kBandRows - 1) / kBandRows;
+	for (int band_index = 0; band_index < band_count; ++band_index) {
+		int slot = band_index % slot_count;
+		{
+			unique_lock<mutex> guard(queue.lock);
+			queue.cv.wait(guard, [&] { return queue.done[slot]; });
+		}
+
+		int rows = min(kBandRows, static_cast<int>(height) - band_index * kBandRows);
+		written = written && WritePNGRows(&writer, slots[slot].data(), rows);
+
+		lock_guard<mutex> guard(queue.lock);
+		queue.done[slot] = false;
+		queue.written_bands += 1;
+		queue.cv.notify_all();
+	}
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+	written = written && ClosePNGWriter(&writer);
+	delete[] gene;
+
+	if (!written) {
+		fprintf(stderr, "Failed to write %s\n", positional[1].c_str());
+		return EXIT_FAILURE;
+	}
+
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	printf("%d polygons, %ux%u, %dx%d samples, %d threads: %.2fs\n", polygon_count, width, height,
+		samples, samples, threads, elapsed);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,310 @@
+#ifndef _RESIDUAL_MAP_HPP_
+#define _RESIDUAL_MAP_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "intrinsics.hpp"
+#include "tiled_image.hpp"
+
+// Keeps the residual map coarse enough for gigapixel sources.
+const int kMaxResidualCells = 1 << 20;
+
+// Per cell squared error between the source and the composite
+// plus summed-area tables of the source colour.
+//
+// The residual is used to place new geometry where the composite
+// is worst and the summed-area tables give the mean colour of any
+// block of cells in constant time.
+struct ResidualMap
+{
+	ResidualMap() : cell_size(1), cells_x(0), cells_y(0), error(NULL), candidate_error(NULL),
+		error_tree(NULL), colour_sat(NULL), count_sat(NULL) {}
+
+	~ResidualMap() {
+		delete[] error;
+		delete[] candidate_error;
+		delete[] error_tree;
+		delete[] colour_sat;
+		delete[] count_sat;
+	}
+
+	int cell_size;
+	int cells_x;
+	int cells_y;
+
+	// Error of the accepted composite and of the candidate being scored.
+	double *error;
+	double *candidate_error;
+
+	// Fenwick tree over |error| with a leading zero, so sampling and updating
+	// a cell are both O(log cells).
+	double *error_tree;
+
+	// (cells_x + 1) x (cells_y + 1) tables with a leading row and column of zeros.
+	double *colour_sat;
+	double *count_sat;
+};
+
+inline
+double AccumulateCellError(const ResidualMap &map, const float *source, const float *composite,
+	                       int stride, const Rect &piece, int channels, double *cells) {
+	int colour_channels = std::min(channels, 3);
+
+	double sum = 0;
+	for (int y = piece.bottom; y < piece.top; ++y) {
+		const float *source_row = source + (y - piece.bottom) * stride * channels;
+		const float *composite_row = composite + (y - piece.bottom) * stride * channels;
+		double *cell_row = cells + (y / map.cell_size) * map.cells_x;
+		for (int x = piece.left; x < piece.right; ++x) {
+			int index = (x - piece.left) * channels;
+			float pixel_error = 0;
+			for (int c = 0; c < colour_channels; ++c) {
+				float diff = source_row[index + c] - composite_row[index + c];
+				pixel_error += diff * diff;
+			}
+			cell_row[x / map.cell_size] += pixel_error;
+			sum += pixel_error;
+		}
+	}
+	return sum;
+}
+
+// Rebuilds the Fenwick tree from every cell in O(cells).
+inline
+void BuildErrorTree(ResidualMap *map) {
+	int cells = map->cells_x * map->cells_y;
+	map->error_tree[0] = 0;
+	for (int i = 1; i <= cells; ++i) {
+		map->error_tree[i] = map->error[i - 1];
+	}
+	for (int i = 1; i <= cells; ++i) {
+		int parent = i + (i & -i);
+		if (parent <= cells)
+			map->error_tree[parent] += map->error_tree[i];
+	}
+}
+
+inline
+void AddTreeError(ResidualMap *map, int cell, double delta) {
+	int cells = map->cells_x * map->cells_y;
+	for (int i = cell + 1; i <= cells; i += i & -i) {
+		map->error_tree[i] += delta;
+	}
+}
+
+// Builds the summed-area tables from |source| and sets the residual
+// to the error against an empty (black) composite.
+inline
+void InitResidualMap(ResidualMap *map, TiledImage *source) {
+	double pixels = static_cast<double>(source->width) * source->height;
+	map->cell_size = std::max(1, static_cast<int>(std::ceil(std::sqrt(pixels / kMaxResidualCells))));
+	map->cells_x = (source->width + map->cell_size - 1) / map->cell_size;
+	map->cells_y = (source->height + map->cell_size - 1) / map->cell_size;
+
+	int cells = map->cells_x * map->cells_y;
+	int sat_size = (map->cells_x + 1) * (map->cells_y + 1);
+	map->error = new double[cells]();
+	map->candidate_error = new double[cells]();
+	map->error_tree = new double[cells + 1];
+	map->colour_sat = new double[sat_size * 3]();
+	map->count_sat = new double[sat_size]();
+
+	bool grey = source->channels < 3;
+	int sat_stride = map->cells_x + 1;
+	for (unsigned int ty = 0; ty < source->tiles_y; ++ty) {
+		for (unsigned int tx = 0; tx < source->tiles_x; ++tx) {
+			const float *data = AcquireTile(source, tx, ty);
+			if (!data)
+				continue;
+
+			Rect rect = TileRect(*source, tx, ty);
+			for (int y = rect.bottom; y < rect.top; ++y) {
+				for (int x = rect.left; x < rect.right; ++x) {
+					const float *pixel = data + ((y - rect.bottom) * source->tile_size + x - rect.left) * source->channels;
+					int cell = (y / map->cell_size + 1) * sat_stride + x / map->cell_size + 1;
+					for (int c = 0; c < 3; ++c) {
+						float value = pixel[grey ? 0 : c];
+						map->colour_sat[cell * 3 + c] += value;
+						map->error[(y / map->cell_size) * map->cells_x + x / map->cell_size] +=
+							c < std::min<int>(source->channels, 3) ? value * value : 0;
+					}
+					map->count_sat[cell] += 1;
+				}
+			}
+		}
+	}
+
+	for (int y = 1; y <= map->cells_y; ++y) {
+		for (int x = 1; x <= map->cells_x; ++x) {
+			int cell = y * sat_stride + x;
+			int left = cell - 1, below = cell - sat_stride, diagonal = cell - sat_stride - 1;
+			for (int c = 0; c < 3; ++c) {
+				map->colour_sat[cell * 3 + c] += map->colour_sat[left * 3 + c] +
+					map->colour_sat[below * 3 + c] - map->colour_sat[diagonal * 3 + c];
+			}
+			map->count_sat[cell] += map->count_sat[left] + map->count_sat[below] - map->count_sat[diagonal];
+		}
+	}
+	BuildErrorTree(map);
+}
+
+inline
+void ClearCandidateError(ResidualMap *map) {
+	memset(map->candidate_error, 0, sizeof(double) * map->cells_x * map->cells_y);
+}
+
+// Makes the error of the last scored candidate the accepted error.
+inline
+void AcceptCandidateError(ResidualMap *map) {
+	std::swap(map->error, map->candidate_error);
+	BuildErrorTree(map);
+}
+
+// Pixel rect covering every cell which |rect| touches.
+inline
+Rect CellAlignedRect(const ResidualMap &map, const Rect &rect, const TiledImage &image) {
+	Rect aligned;
+	aligned.left = rect.left / map.cell_size * map.cell_size;
+	aligned.bottom = rect.bottom / map.cell_size * map.cell_size;
+	aligned.right = std::min<int>(image.width, (rect.right + map.cell_size - 1) / map.cell_size * map.cell_size);
+	aligned.top = std::min<int>(image.height, (rect.top + map.cell_size - 1) / map.cell_size * map.cell_size);
+	return aligned;
+}
+
+// Recomputes the accepted error of the cells within |rect| from the composite.
+inline
+void UpdateResidual(ResidualMap *map, TiledImage *source, TiledImage *composite, const Rect &rect) {
+	if (IsEmpty(rect))
+		return;
+
+	Rect aligned = CellAlignedRect(*map, rect, *composite);
+	int min_x = aligned.left / map->cell_size;
+	int min_y = aligned.bottom / map->cell_size;
+	int max_x = (aligned.right + map->cell_size - 1) / map->cell_size;
+	int max_y = (aligned.top + map->cell_size - 1) / map->cell_size;
+
+	// The tree is updated with the change of each cell once they've all been recomputed.
+	for (int y = min_y; y < max_y; ++y) {
+		for (int x = min_x; x < max_x; ++x) {
+			int cell = y * map->cells_x + x;
+			AddTreeError(map, cell, -map->error[cell]);
+			map->error[cell] = 0;
+		}
+	}
+
+	ForEachTileRect(*composite, aligned, [&](unsigned int tx, unsigned int ty, const Rect &piece) {
+		int offset = TileOffset(*composite, tx, ty, piece);
+		const float *composite_data = AcquireTile(composite, tx, ty);
+		const float *source_data = AcquireTile(source, tx, ty);
+		if (!composite_data || !source_data)
+			return;
+
+		AccumulateCellError(*map, source_data + offset, composite_data + offset, composite->tile_size, piece,
+			composite->channels, map->error);
+	});
+
+	for (int y = min_y; y < max_y; ++y) {
+		for (int x = min_x; x < max_x; ++x) {
+			int cell = y * map->cells_x + x;
+			AddTreeError(map, cell, map->error[cell]);
+		}
+	}
+}
+
+// Picks a cell within [|min_x|, |max_x|) x [|min_y|, |max_y|) with probability
+// proportional to its error and returns a uniformly random point within it
+// in normalized coordinates. Cells are picked uniformly when none has any error.
+inline
+void SampleResidualRect(const ResidualMap &map, int min_x, int min_y, int max_x, int max_y,
+	                    const TiledImage &image, float *x, float *y) {
+	double total = 0;
+	for (int cy = min_y; cy < max_y; ++cy) {
+		for (int cx = min_x; cx < max_x; ++cx) {
+			total += map.error[cy * map.cells_x + cx];
+		}
+	}
+
+	int cell_x = min_x, cell_y = min_y;
+	if (total > 0) {
+		double target = Randd(0, total);
+		for (int cy = min_y; cy < max_y && target >= 0; ++cy) {
+			for (int cx = min_x; cx < max_x && target >= 0; ++cx) {
+				target -= map.error[cy * map.cells_x + cx];
+				cell_x = cx;
+				cell_y = cy;
+			}
+		}
+	} else {
+		cell_x = std::min(max_x - 1, min_x + static_cast<int>(Randd(0, max_x - min_x)));
+		cell_y = std::min(max_y - 1, min_y + static_cast<int>(Randd(0, max_y - min_y)));
+	}
+
+	*x = (cell_x + Randf(0, 1)) * map.cell_size / image.width;
+	*y = (cell_y + Randf(0, 1)) * map.cell_size / image.height;
+	clamp(x, 0.0f, 1.0f);
+	clamp(y, 0.0f, 1.0f);
+}
+
+// Like SampleResidualRect over the whole image but in O(log cells).
+inline
+void SampleResidual(ResidualMap *map, const TiledImage &image, float *x, float *y) {
+	int cells = map->cells_x * map->cells_y;
+
+	// Total error, and the highest power of two within the tree for the descent.
+	double total = 0;
+	int top_bit = 1;
+	for (int i = cells; i > 0; i -= i & -i) {
+		total += map->error_tree[i];
+	}
+	while (top_bit * 2 <= cells)
+		top_bit *= 2;
+
+	int cell;
+	if (total > 0) {
+		// Finds the first cell whose running error exceeds |target|.
+		double target = Randd(0, total);
+		cell = 0;
+		for (int bit = top_bit; bit > 0; bit /= 2) {
+			if (cell + bit <= cells && map->error_tree[cell + bit] <= target) {
+				cell += bit;
+				target -= map->error_tree[cell];
+			}
+		}
+		cell = std::min(cells - 1, cell);
+	} else {
+		cell = std::min(cells - 1, static_cast<int>(Randd(0, cells)));
+	}
+
+	*x = (cell % map->cells_x + Randf(0, 1)) * map->cell_size / image.width;
+	*y = (cell / map->cells_x + Randf(0, 1)) * map->cell_size / image.height;
+	clamp(x, 0.0f, 1.0f);
+	clamp(y, 0.0f, 1.0f);
+}
+
+// Mean source colour of the cells within |radius| cells of the normalized point (|x|, |y|).
+inline
+void MeanColour(const ResidualMap &map, const TiledImage &image, float x, float y, int radius,
+	            float *colour) {
+	int cell_x = std::min(map.cells_x - 1, static_cast<int>(x * image.width) / map.cell_size);
+	int cell_y = std::min(map.cells_y - 1, static_cast<int>(y * image.height) / map.cell_size);
+
+	int left = std::max(0, cell_x - radius);
+	int bottom = std::max(0, cell_y - radius);
+	int right = std::min(map.cells_x, cell_x + radius + 1);
+	int top = std::min(map.cells_y, cell_y + radius + 1);
+
+	int stride = map.cells_x + 1;
+	int a = bottom * stride + left, b = bottom * stride + right;
+	int c = top * stride + left, d = top * stride + right;
+
+	double count = map.count_sat[d] - map.count_sat[b] - map.count_sat[c] + map.count_sat[a];
+	for (int i = 0; i < 3; ++i) {
+		double sum = map.colour_sat[d * 3 + i] - map.colour_sat[b * 3 + i] -
+			map.colour_sat[c * 3 + i] + map.colour_sat[a * 3 + i];
+		colour[i] = static_cast<float>(sum / count);
+	}
+}
+
+#endif
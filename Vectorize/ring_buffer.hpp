@@ -0,0 +1,52 @@
+#ifndef _RING_BUFFER_HPP_
+#define _RING_BUFFER_HPP_
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free single producer, single consumer queue.
+template <typename T>
+struct RingBuffer
+{
+	RingBuffer(size_t capacity) : capacity(capacity), items(new T[capacity]), head(0), tail(0) {}
+
+	~RingBuffer() {
+		delete[] items;
+	}
+
+	size_t capacity;
+	T *items;
+
+	// Next slot to pop, only written by the consumer.
+	std::atomic<size_t> head;
+
+	// Keeps |head| and |tail| on separate cache lines.
+	char padding[64];
+
+	// Next slot to push, only written by the producer.
+	std::atomic<size_t> tail;
+};
+
+template <typename T>
+bool TryPush(RingBuffer<T> *ring, const T &item) {
+	size_t tail = ring->tail.load(std::memory_order_relaxed);
+	if (tail - ring->head.load(std::memory_order_acquire) == ring->capacity)
+		return false;
+
+	ring->items[tail % ring->capacity] = item;
+	ring->tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename T>
+bool TryPop(RingBuffer<T> *ring, T *item) {
+	size_t head = ring->head.load(std::memory_order_relaxed);
+	if (head == ring->tail.load(std::memory_order_acquire))
+		return false;
+
+	*item = ring->items[head % ring->capacity];
+	ring->head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+#endif
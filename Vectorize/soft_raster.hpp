@@ -0,0 +1,476 @@
+#ifndef _SOFT_RASTER_HPP_
+#define _SOFT_RASTER_HPP_
+
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "gene.hpp"
+#include "tiled_image.hpp"
+#include "triangulate.hpp"
+
+// Differentiable CPU rasterizer for refining every polygon of a gene at once.
+//
+// Polygons are drawn the way GL draws them, as their cached triangulation alpha blended in
+// gene order over black, except each triangle edge ramps linearly from outside to inside over
+// |kSoftEdgeWidth| pixels instead of stepping. Coverage is then piecewise polynomial in the
+// vertices, so a forward pass and a backward pass give the exact gradient of the summed squared
+// error with respect to every colour channel, alpha and vertex coordinate.
+//
+// Images are in pixels with y pointing up, like TiledImage. Both passes are split into bands
+// of rows across threads, and the loops over a triangle's pixels run four at a time with SSE.
+
+const float kSoftEdgeWidth = 1.0f;
+
+// Working copy of the source the gradient is taken against.
+struct SoftImage
+{
+	SoftImage() : width(0), height(0), channels(0) {}
+
+	int width;
+	int height;
+
+	// At most 3, see ColourChannels().
+	int channels;
+	std::vector<float> data;
+};
+
+// Box filters |source| down so its longest side is at most |max_size| pixels. Each tile is
+// visited once and summed straight into the downsampled image, so nothing beyond the source's
+// own resident tiles is held. Returns false if a tile couldn't be mapped.
+inline
+bool DownsampleTiledImage(TiledImage *source, int max_size, SoftImage *image) {
+	int source_width = static_cast<int>(source->width);
+	int source_height = static_cast<int>(source->height);
+	int factor = std::max(1, (std::max(source_width, source_height) + max_size - 1) / max_size);
+
+	image->width = (source_width + factor - 1) / factor;
+	image->height = (source_height + factor - 1) / factor;
+	image->channels = std::min(static_cast<int>(source->channels), 3);
+
+	std::vector<double> sums(static_cast<size_t>(image->width) * image->height * image->channels, 0);
+	Rect source_rect = { 0, 0, source_width, source_height };
+	bool read = true;
+	ForEachTileRect(*source, source_rect, [&](unsigned int tx, unsigned int ty, const Rect &piece) {
+		const float *data = AcquireTile(source, tx, ty);
+		if (!data) {
+			read = false;
+			return;
+		}
+		data += TileOffset(*source, tx, ty, piece);
+		for (int y = piece.bottom; y < piece.top; ++y, data += source->tile_size * source->channels) {
+			double *row = &sums[static_cast<size_t>(y / factor) * image->width * image->channels];
+			const float *sample = data;
+			for (int x = piece.left; x < piece.right; ++x, sample += source->channels) {
+				double *pixel = row + (x / factor) * image->channels;
+				for (int c = 0; c < image->channels; ++c) {
+					pixel[c] += sample[c];
+				}
+			}
+		}
+	});
+	if (!read) {
+		image->data.clear();
+		return false;
+	}
+
+	// Pixels on the right and top edges cover fewer source pixels.
+	image->data.resize(sums.size());
+	for (int y = 0; y < image->height; ++y) {
+		int rows = std::min(source_height, (y + 1) * factor) - y * factor;
+		for (int x = 0; x < image->width; ++x) {
+			int columns = std::min(source_width, (x + 1) * factor) - x * factor;
+			size_t i = (static_cast<size_t>(y) * image->width + x) * image->channels;
+			for (int c = 0; c < image->channels; ++c) {
+				image->data[i + c] = static_cast<float>(sums[i + c] / (rows * columns));
+			}
+		}
+	}
+	return true;
+}
+
+// A counter clockwise triangle in pixels. Edge k runs from corner k to corner k + 1 and
+// its signed distance nx * x + ny * y + nc is positive inside.
+struct SoftTriangle
+{
+	float x[3], y[3];
+	float nx[3], ny[3], nc[3];
+
+	// Index of each corner in the polygon's vertices.
+	int vertices[3];
+};
+
+struct SoftPolygon
+{
+	Colour colour;
+
+	int first_triangle;
+	int triangle_count;
+
+	// Pixels the soft edges can touch, inclusive, empty if min_x > max_x.
+	int min_x, min_y, max_x, max_y;
+
+	// Offset of the polygon in a flattened gene, its colour channels and alpha then its vertices.
+	int first_parameter;
+};
+
+struct SoftScene
+{
+	int width;
+	int height;
+
+	std::vector<SoftPolygon> polygons;
+	std::vector<SoftTriangle> triangles;
+
+	int parameter_count;
+};
+
+inline
+void BuildSoftScene(const Poly *gene, int polygon_count, int width, int height, SoftScene *scene) {
+	scene->width = width;
+	scene->height = height;
+	scene->polygons.resize(polygon_count);
+	scene->triangles.clear();
+	scene->parameter_count = 0;
+
+	for (int i = 0; i < polygon_count; ++i) {
+		const Poly &polygon = gene[i];
+		Triangulate(polygon);
+
+		SoftPolygon &soft = scene->polygons[i];
+		soft.colour = polygon.colour;
+		soft.first_triangle = static_cast<int>(scene->triangles.size());
+		soft.triangle_count = polygon.triangle_count;
+		soft.first_parameter = scene->parameter_count;
+		scene->parameter_count += 4 + polygon.vertex_count * 2;
+
+		float min_x = static_cast<float>(width), min_y = static_cast<float>(height);
+		float max_x = 0, max_y = 0;
+		for (int j = 0; j < polygon.triangle_count; ++j) {
+			SoftTriangle triangle;
+			for (int k = 0; k < 3; ++k) {
+				const Vertex &vertex = polygon.triangles[j * 3 + k];
+				triangle.x[k] = vertex.x * width;
+				triangle.y[k] = vertex.y * height;
+				triangle.vertices[k] = polygon.triangle_vertices[j * 3 + k];
+				min_x = std::min(min_x, triangle.x[k]);
+				min_y = std::min(min_y, triangle.y[k]);
+				max_x = std::max(max_x, triangle.x[k]);
+				max_y = std::max(max_y, triangle.y[k]);
+			}
+			for (int k = 0; k < 3; ++k) {
+				float ex = triangle.x[(k + 1) % 3] - triangle.x[k];
+				float ey = triangle.y[(k + 1) % 3] - triangle.y[k];
+				float inv_length = 1.0f / std::sqrt(ex * ex + ey * ey);
+				triangle.nx[k] = -ey * inv_length;
+				triangle.ny[k] = ex * inv_length;
+				triangle.nc[k] = (ey * triangle.x[k] - ex * triangle.y[k]) * inv_length;
+			}
+			scene->triangles.push_back(triangle);
+		}
+
+		// Pixel centers are at half integers, and the ramps reach half an edge width outside.
+		soft.min_x = std::max(0, static_cast<int>(std::floor(min_x - kSoftEdgeWidth)));
+		soft.min_y = std::max(0, static_cast<int>(std::floor(min_y - kSoftEdgeWidth)));
+		soft.max_x = std::min(width - 1, static_cast<int>(std::ceil(max_x + kSoftEdgeWidth)));
+		soft.max_y = std::min(height - 1, static_cast<int>(std::ceil(max_y + kSoftEdgeWidth)));
+		if (polygon.triangle_count == 0)
+			soft.min_x = soft.max_x + 1;
+	}
+}
+
+// Sums over the pixels of one triangle edge of dE/dd, where d is the pixel's signed distance
+// to the edge, weighted by 1, x, y and d. The gradient with respect to both ends of the edge
+// is linear in these, see AddEdgeGradient().
+struct SoftEdgeSums
+{
+	double g, gx, gy, gd;
+};
+
+struct SoftGradient
+{
+	// Summed squared error of the soft render.
+	double error;
+
+	// Laid out like SoftPolygon::first_parameter, with vertices in gene units.
+	std::vector<double> parameters;
+
+	// Three per triangle of the scene.
+	std::vector<SoftEdgeSums> edges;
+};
+
+inline
+float HorizontalSum(__m128 v) {
+	float lanes[4];
+	_mm_storeu_ps(lanes, v);
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+// Adds the coverage of |triangle| along row |y| to |count| pixels from |x|.
+// |count| must be a multiple of 4.
+inline
+void AddTriangleCoverage(const SoftTriangle &triangle, int x, int y, int count, float *coverage) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const float inv_width = 1.0f / kSoftEdgeWidth;
+	float center_y = y + 0.5f;
+
+	__m128 a[3], b[3];
+	for (int k = 0; k < 3; ++k) {
+		a[k] = _mm_set1_ps(triangle.nx[k] * inv_width);
+		b[k] = _mm_set1_ps((triangle.ny[k] * center_y + triangle.nc[k]) * inv_width + 0.5f);
+	}
+
+	__m128 px = _mm_set_ps(x + 3.5f, x + 2.5f, x + 1.5f, x + 0.5f);
+	const __m128 step = _mm_set1_ps(4.0f);
+	for (int i = 0; i < count; i += 4) {
+		__m128 r0 = _mm_min_ps(one, _mm_max_ps(zero, _mm_add_ps(_mm_mul_ps(a[0], px), b[0])));
+		__m128 r1 = _mm_min_ps(one, _mm_max_ps(zero, _mm_add_ps(_mm_mul_ps(a[1], px), b[1])));
+		__m128 r2 = _mm_min_ps(one, _mm_max_ps(zero, _mm_add_ps(_mm_mul_ps(a[2], px), b[2])));
+		__m128 sum = _mm_add_ps(_mm_loadu_ps(coverage + i), _mm_mul_ps(_mm_mul_ps(r0, r1), r2));
+		_mm_storeu_ps(coverage + i, sum);
+		px = _mm_add_ps(px, step);
+	}
+}
+
+// Accumulates the edge sums of |triangle| along row |y| given dE/dcoverage of |count| pixels from |x|.
+// |count| must be a multiple of 4.
+inline
+void AccumulateEdgeSums(const SoftTriangle &triangle, int x, int y, int count, const float *coverage_gradient,
+	                    SoftEdgeSums *sums) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 slope = _mm_set1_ps(1.0f / kSoftEdgeWidth);
+	const __m128 width = _mm_set1_ps(kSoftEdgeWidth);
+	const float inv_width = 1.0f / kSoftEdgeWidth;
+	float center_y = y + 0.5f;
+
+	__m128 a[3], b[3];
+	__m128 g[3], gx[3], gd[3];
+	for (int k = 0; k < 3; ++k) {
+		a[k] = _mm_set1_ps(triangle.nx[k] * inv_width);
+		b[k] = _mm_set1_ps((triangle.ny[k] * center_y + triangle.nc[k]) * inv_width + 0.5f);
+		g[k] = gx[k] = gd[k] = zero;
+	}
+
+	__m128 px = _mm_set_ps(x + 3.5f, x + 2.5f, x + 1.5f, x + 0.5f);
+	const __m128 step = _mm_set1_ps(4.0f);
+	for (int i = 0; i < count; i += 4) {
+		__m128 raw[3], r[3], dr[3];
+		for (int k = 0; k < 3; ++k) {
+			raw[k] = _mm_add_ps(_mm_mul_ps(a[k], px), b[k]);
+			r[k] = _mm_min_ps(one, _mm_max_ps(zero, raw[k]));
+			// The ramp only has a slope strictly between its ends.
+			dr[k] = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(raw[k], zero), _mm_cmplt_ps(raw[k], one)), slope);
+		}
+
+		__m128 dc = _mm_loadu_ps(coverage_gradient + i);
+		__m128 ge[3];
+		ge[0] = _mm_mul_ps(_mm_mul_ps(dc, dr[0]), _mm_mul_ps(r[1], r[2]));
+		ge[1] = _mm_mul_ps(_mm_mul_ps(dc, dr[1]), _mm_mul_ps(r[0], r[2]));
+		ge[2] = _mm_mul_ps(_mm_mul_ps(dc, dr[2]), _mm_mul_ps(r[0], r[1]));
+		for (int k = 0; k < 3; ++k) {
+			__m128 distance = _mm_mul_ps(_mm_sub_ps(raw[k], half), width);
+			g[k] = _mm_add_ps(g[k], ge[k]);
+			gx[k] = _mm_add_ps(gx[k], _mm_mul_ps(ge[k], px));
+			gd[k] = _mm_add_ps(gd[k], _mm_mul_ps(ge[k], distance));
+		}
+		px = _mm_add_ps(px, step);
+	}
+
+	for (int k = 0; k < 3; ++k) {
+		double row_g = HorizontalSum(g[k]);
+		sums[k].g += row_g;
+		sums[k].gx += HorizontalSum(gx[k]);
+		sums[k].gy += row_g * center_y;
+		sums[k].gd += HorizontalSum(gd[k]);
+	}
+}
+
+// Renders rows [min_y, max_y) and backpropagates their error into |gradient|.
+//
+// Blending is undone polygon by polygon in reverse, so only the composite and the
+// transmittance of the polygons above the current one are kept per pixel.
+inline
+void SoftRasterBand(const SoftScene &scene, const SoftImage &source, int min_y, int max_y,
+	                SoftGradient *gradient) {
+	int width = scene.width;
+	int channels = source.channels;
+	int rows = max_y - min_y;
+
+	std::vector<float> composite(width * rows * channels, 0.0f);
+	std::vector<float> composite_gradient(width * rows * channels);
+	std::vector<float> transmittance(width * rows, 1.0f);
+	std::vector<float> coverage(width + 3);
+	std::vector<float> coverage_gradient(width + 3);
+
+	for (size_t i = 0; i < scene.polygons.size(); ++i) {
+		const SoftPolygon &polygon = scene.polygons[i];
+		const float colour[3] = { polygon.colour.r, polygon.colour.g, polygon.colour.b };
+		int count = polygon.max_x - polygon.min_x + 1;
+		int padded = (count + 3) & ~3;
+
+		for (int y = std::max(polygon.min_y, min_y); y <= std::min(polygon.max_y, max_y - 1) && count > 0; ++y) {
+			std::fill(coverage.begin(), coverage.begin() + padded, 0.0f);
+			for (int t = 0; t < polygon.triangle_count; ++t) {
+				AddTriangleCoverage(scene.triangles[polygon.first_triangle + t], polygon.min_x, y,
+					padded, coverage.data());
+			}
+
+			float *pixel = &composite[((y - min_y) * width + polygon.min_x) * channels];
+			for (int j = 0; j < count; ++j, pixel += channels) {
+				float alpha = polygon.colour.a * std::min(coverage[j], 1.0f);
+				for (int c = 0; c < channels; ++c) {
+					pixel[c] += alpha * (colour[c] - pixel[c]);
+				}
+			}
+		}
+	}
+
+	double error = 0;
+	for (int y = 0; y < rows; ++y) {
+		const float *target = &source.data[(min_y + y) * width * channels];
+		const float *pixel = &composite[y * width * channels];
+		float *pixel_gradient = &composite_gradient[y * width * channels];
+		float row_error = 0;
+		for (int j = 0; j < width * channels; ++j) {
+			float diff = pixel[j] - target[j];
+			row_error += diff * diff;
+			pixel_gradient[j] = 2 * diff;
+		}
+		error += row_error;
+	}
+	gradient->error += error;
+
+	for (int i = static_cast<int>(scene.polygons.size()) - 1; i >= 0; --i) {
+		const SoftPolygon &polygon = scene.polygons[i];
+		const float colour[3] = { polygon.colour.r, polygon.colour.g, polygon.colour.b };
+		int count = polygon.max_x - polygon.min_x + 1;
+		int padded = (count + 3) & ~3;
+
+		double colour_gradient[4] = { 0, 0, 0, 0 };
+		for (int y = std::max(polygon.min_y, min_y); y <= std::min(polygon.max_y, max_y - 1) && count > 0; ++y) {
+			std::fill(coverage.begin(), coverage.begin() + padded, 0.0f);
+			for (int t = 0; t < polygon.triangle_count; ++t) {
+				AddTriangleCoverage(scene.triangles[polygon.first_triangle + t], polygon.min_x, y,
+					padded, coverage.data());
+			}
+
+			float row_gradient[4] = { 0, 0, 0, 0 };
+			int offset = (y - min_y) * width + polygon.min_x;
+			for (int j = 0; j < count; ++j) {
+				float covered = std::min(coverage[j], 1.0f);
+				float alpha = polygon.colour.a * covered;
+				float inv_remaining = 1.0f / (1.0f - alpha);
+				float &pixel_transmittance = transmittance[offset + j];
+				float *pixel = &composite[(offset + j) * channels];
+				const float *pixel_gradient = &composite_gradient[(offset + j) * channels];
+
+				float alpha_gradient = 0;
+				for (int c = 0; c < channels; ++c) {
+					float below = (pixel[c] - colour[c] * alpha) * inv_remaining;
+					float weight = pixel_gradient[c] * pixel_transmittance;
+					alpha_gradient += weight * (colour[c] - below);
+					row_gradient[c] += weight * alpha;
+					pixel[c] = below;
+				}
+				row_gradient[3] += alpha_gradient * covered;
+				coverage_gradient[j] = coverage[j] < 1.0f ? alpha_gradient * polygon.colour.a : 0.0f;
+				pixel_transmittance *= 1.0f - alpha;
+			}
+			std::fill(coverage_gradient.begin() + count, coverage_gradient.begin() + padded, 0.0f);
+
+			for (int c = 0; c < 4; ++c) {
+				colour_gradient[c] += row_gradient[c];
+			}
+			for (int t = 0; t < polygon.triangle_count; ++t) {
+				int triangle = polygon.first_triangle + t;
+				AccumulateEdgeSums(scene.triangles[triangle], polygon.min_x, y, padded,
+					coverage_gradient.data(), &gradient->edges[triangle * 3]);
+			}
+		}
+
+		for (int c = 0; c < 4; ++c) {
+			gradient->parameters[polygon.first_parameter + c] += colour_gradient[c];
+		}
+	}
+}
+
+// Adds the gradient of edge |k| of |triangle| to its two vertices.
+inline
+void AddEdgeGradient(const SoftScene &scene, const SoftTriangle &triangle, int k, const SoftEdgeSums &sums,
+	                 double *vertices) {
+	int k2 = (k + 1) % 3;
+	double px = triangle.x[k], py = triangle.y[k];
+	double qx = triangle.x[k2], qy = triangle.y[k2];
+	double ex = qx - px, ey = qy - py;
+	double length = std::sqrt(ex * ex + ey * ey);
+	double length2 = length * length;
+
+	// d = ((q - p) x (pixel - p)) / |q - p|, differentiated with respect to p and q.
+	double *p = vertices + triangle.vertices[k] * 2;
+	double *q = vertices + triangle.vertices[k2] * 2;
+	p[0] += ((qy * sums.g - sums.gy) / length + ex * sums.gd / length2) * scene.width;
+	p[1] += ((sums.gx - qx * sums.g) / length + ey * sums.gd / length2) * scene.height;
+	q[0] += ((sums.gy - py * sums.g) / length - ex * sums.gd / length2) * scene.width;
+	q[1] += ((px * sums.g - sums.gx) / length - ey * sums.gd / length2) * scene.height;
+}
+
+// Renders |scene| and computes the gradient of its squared error against |source|, which must be
+// the scene's size, splitting rows evenly across |threads|.
+inline
+void ComputeSoftGradient(const SoftScene &scene, const SoftImage &source, int threads, SoftGradient *gradient) {
+	threads = std::max(1, std::min(threads, scene.height));
+
+	std::vector<SoftGradient> bands(threads);
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; ++i) {
+		SoftGradient &band = bands[i];
+		band.error = 0;
+		band.parameters.assign(scene.parameter_count, 0.0);
+		band.edges.assign(scene.triangles.size() * 3, SoftEdgeSums());
+
+		int min_y = scene.height * i / threads;
+		int max_y = scene.height * (i + 1) / threads;
+		if (i + 1 < threads) {
+			workers.push_back(std::thread(SoftRasterBand, std::cref(scene), std::cref(source), min_y, max_y, &band));
+		} else {
+			SoftRasterBand(scene, source, min_y, max_y, &band);
+		}
+	}
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+
+	*gradient = bands[0];
+	for (int i = 1; i < threads; ++i) {
+		gradient->error += bands[i].error;
+		for (int j = 0; j < scene.parameter_count; ++j) {
+			gradient->parameters[j] += bands[i].parameters[j];
+		}
+		for (size_t j = 0; j < gradient->edges.size(); ++j) {
+			SoftEdgeSums &sums = gradient->edges[j];
+			sums.g += bands[i].edges[j].g;
+			sums.gx += bands[i].edges[j].gx;
+			sums.gy += bands[i].edges[j].gy;
+			sums.gd += bands[i].edges[j].gd;
+		}
+	}
+
+	for (size_t i = 0; i < scene.polygons.size(); ++i) {
+		const SoftPolygon &polygon = scene.polygons[i];
+		double *vertices = &gradient->parameters[polygon.first_parameter + 4];
+		for (int t = 0; t < polygon.triangle_count; ++t) {
+			int triangle = polygon.first_triangle + t;
+			for (int k = 0; k < 3; ++k) {
+				AddEdgeGradient(scene, scene.triangles[triangle], k, gradient->edges[triangle * 3 + k], vertices);
+			}
+		}
+	}
+}
+
+#endif
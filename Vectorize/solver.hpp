@@ -0,0 +1,1529 @@
+#ifndef _SOLVER_HPP_
+#define _SOLVER_HPP_
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "gene.hpp"
+#include "gene_codec.hpp"
+#include "gl_util.hpp"
+#include "polygon_index.hpp"
+#include "residual_map.hpp"
+#include "ring_buffer.hpp"
+#include "soft_raster.hpp"
+#include "tiled_image.hpp"
+#include "triangulate.hpp"
+
+// The hill-climbing solver shared by the vectorize tool and the library in vectorize_lib.cpp.
+//
+// Everything here expects a current GL context, see InitGLState().
+
+const int kMaxPolygons = 1 << 16;
+const int kMaxVertices = 1024;
+
+// Radius in residual cells over which new polygons take their mean colour.
+const int kSeedColourRadius = 1;
+const size_t kDefaultMemoryBudget = 512;
+
+const int kPipelineDepth = 64;
+const int kCommitLogSize = 256;
+
+// Candidates covering more pixels than this are scored on the GL thread
+// rather than copying their pixels through the pipeline.
+const int kMaxPipelineRectPixels = 1 << 20;
+
+// Longest side of the source copy gradient refinement works on, see GradientRefine().
+const int kGradientMaxSize = 512;
+const float kGradientVertexRate = 0.5f / kGradientMaxSize;
+const float kGradientColourRate = 0.01f;
+const float kAdamBeta1 = 0.9f;
+const float kAdamBeta2 = 0.999f;
+const float kAdamEpsilon = 1e-8f;
+
+const float kLocalSearchInitialStep = 1.0f / 32;
+const float kLocalSearchMinStep = 1.0f / 4096;
+
+const float kAddPolygonRate = 1.0f / 700;
+const float kRemovePolygonRate = 1.0f / 1500;
+const float kSwapPolygonRate = 1.0f / 1000;
+
+const float kAlphaMutationRate = 1.0f / 750;
+const float kAlphaMutationSigma = 0.02f;
+const float kAlphaMin = 30.0f / 255;
+const float kAlphaMax = 60.0f / 255;
+
+const float kRedMutationRate = 1.0f / 750;
+const float kRedMutationSigma = 0.1f;
+const float kRedMin = 0.0f;
+const float kRedMax = 1.0f;
+
+const float kGreenMutationRate = 1.0f / 750;
+const float kGreenMutationSigma = 0.1f;
+const float kGreenMin = 0.0f;
+const float kGreenMax = 1.0f;
+
+const float kBlueMutationRate = 1.0f / 750;
+const float kBlueMutationSigma = 0.1f;
+const float kBlueMin = 0.0f;
+const float kBlueMax = 1.0f;
+
+const float kVertexMutationRate = 1.0f / 750;
+const float kVertexMutationSigma = 0.1f;
+const float kVertexMin = 0.0f;
+const float kVertexMax = 1.0f;
+
+const float kAddVertexRate = 1.0f / 1000;
+const float kRemoveVertexRate = 1.0f / 1500;
+const float kSwapVertexRate = 1.0f / 1000;
+
+struct GeneImage
+{
+	GeneImage() : polygon_count(0), polygon_capacity(0), gene(NULL),
+		fitness(std::numeric_limits<double>::max()), composite_valid(false) {}
+
+	~GeneImage() {
+		if (gene)
+			delete[] gene;
+	}
+
+	TiledImage composite;
+
+	// |gene| has room for |polygon_capacity| polygons, so adding and
+	// removing them doesn't reallocate it, see ReserveGene().
+	int polygon_count;
+	int polygon_capacity;
+	Poly *gene;
+
+	double fitness;
+
+	// Bounds of every polygon, only maintained for genes with a composite.
+	PolygonIndex index;
+
+	// Whether |composite| and |fitness| match |gene|, see SyncComposite().
+	bool composite_valid;
+};
+
+// Adam moments of one polygon, kept from one gradient refinement to the next.
+struct AdamPolygon
+{
+	AdamPolygon() : key(0), steps(0) {}
+
+	// PolygonKey() of the polygon as the refinement left it, so it's found again after
+	// polygons were added or removed around it. Polygons moved since start afresh.
+	uint64_t key;
+	int steps;
+
+	// Colour channels and alpha then vertices, like SoftPolygon::first_parameter.
+	std::vector<float> m, v;
+};
+
+struct SimulationState
+{
+	SimulationState() : seed(0), pipeline_starts(0), iterations(0), added_polygons(0),
+		accepted_added_polygons(0), quantize(false), local_search_polygon(0), local_search_step(0),
+		local_search_improved(false), tile_framebuffer(0), tile_colour_buffer(0) {}
+
+	TiledImage source_image;
+	GeneImage gene_image;
+	ResidualMap residual;
+
+	// Seeds rand() on every thread mutating the gene as well as |random|.
+	unsigned int seed;
+	std::default_random_engine random;
+
+	// Times the pipeline was started, so a restarted generator doesn't replay the same changes.
+	unsigned int pipeline_starts;
+
+	// Guards |residual| while the pipeline's generator samples from it.
+	std::mutex residual_lock;
+
+	int iterations;
+	int added_polygons;
+	int accepted_added_polygons;
+
+	// Whether candidates are snapped to |encoding| before being scored.
+	bool quantize;
+	GeneEncoding encoding;
+
+	// Where LocalSearch() stopped, so interleaved searches with small budgets
+	// carry on through the gene rather than restarting at its first polygon.
+	int local_search_polygon;
+	float local_search_step;
+	bool local_search_improved;
+
+	GLuint tile_framebuffer;
+	GLuint tile_colour_buffer;
+
+	// Polygons overlapping the region being rendered and a tile sized buffer to render them into.
+	std::vector<int> render_list;
+	std::vector<float> scratch;
+
+	// Downsampled source for gradient refinement, created on first use.
+	SoftImage soft_source;
+
+	// Moments of every polygon as of the last gradient refinement which was kept.
+	std::vector<AdamPolygon> adam;
+
+	// Gradient refinement renders the refined gene here and swaps it with the composite
+	// only if it's kept. Created on first use, its tiles are unmapped between uses.
+	TiledImage spare_composite;
+};
+
+enum CandidateKind
+{
+	kModifyPolygon,
+	kAddPolygon,
+	kRemovePolygon,
+	kSwapPolygon
+};
+
+// A single change to a gene flowing through the pipeline.
+struct Candidate
+{
+	Candidate() : kind(kModifyPolygon), index(-1), other_index(-1), base_version(0),
+		render_version(0), bounds(), delta(0), fitness(0) {}
+
+	CandidateKind kind;
+	int index;
+	int other_index;
+	Poly polygon;
+
+	// Gene version the candidate was generated from and rendered against.
+	unsigned long long base_version;
+	unsigned long long render_version;
+
+	// Pixels which the change can affect, copied out for the scorers.
+	Rect bounds;
+	std::vector<float> rendered;
+	std::vector<float> composite;
+	std::vector<float> source;
+
+	// Change in summed squared error and the fitness once committed.
+	double delta;
+	double fitness;
+};
+
+inline
+float BoltzmannProbability(double current_fitness, double new_fitness, float temperature) {
+	return temperature <= 0 ? 0 : exp(-(new_fitness - current_fitness) / temperature);
+}
+
+inline
+int ColourChannels(int channels) {
+	return std::min(channels, 3);
+}
+
+inline
+double RegionError(const float *buffer1, int stride1, const float *buffer2, int stride2,
+	               int width, int height, int channels) {
+	double sum = 0;
+	for (int y = 0; y < height; ++y) {
+		float row_sum = 0;
+		for (int x = 0; x < width; ++x) {
+			int index1 = (y * stride1 + x) * channels;
+			int index2 = (y * stride2 + x) * channels;
+			for (int c = 0; c < ColourChannels(channels); ++c) {
+				float diff = (buffer1[index1 + c] - buffer2[index2 + c]);
+				row_sum += diff * diff;
+			}
+		}
+		sum += row_sum;
+	}
+	return sum;
+}
+
+inline
+int PixelIndex(int x, int y, int width, int channels) {
+	return (y * width + x) * channels;
+
+}
+
+inline
+void SeedState(SimulationState &state, unsigned int seed) {
+	state.seed = seed;
+	state.random.seed(seed);
+	srand(seed);
+}
+
+inline
+void InitRandomVertex(Vertex &vertex, float center_x, float center_y) {
+	vertex.x = center_x + Randf(-0.001f, 0.001f);
+	vertex.y = center_y + Randf(-0.001f, 0.001f);
+	clamp(&vertex.x, kVertexMin, kVertexMax);
+	clamp(&vertex.y, kVertexMin, kVertexMax);
+}
+
+// Places the polygon where the composite is worst and colours it with the
+// mean of the surrounding source.
+inline
+void InitRandomPolygon(SimulationState &state, Poly &polygon, int vertices) {
+	float center_x, center_y;
+	{
+		std::lock_guard<std::mutex> guard(state.residual_lock);
+		SampleResidual(&state.residual, state.source_image, &center_x, &center_y);
+	}
+
+	float colour[3];
+	MeanColour(state.residual, state.source_image, center_x, center_y, kSeedColourRadius, colour);
+
+	polygon.colour.r = colour[0];
+	polygon.colour.g = colour[1];
+	polygon.colour.b = colour[2];
+	polygon.colour.a = Randf(kAlphaMin, kAlphaMax);
+
+	polygon.vertices = new Vertex[vertices];
+	polygon.vertex_count = vertices;
+	for (int i = 0; i < polygon.vertex_count; ++i) {
+		InitRandomVertex(polygon.vertices[i], center_x, center_y);
+	}
+}
+
+inline
+void CalculateCentroid(Poly &polygon, float &x, float &y) {
+	x = 0;
+	y = 0;
+	for (int i = 0; i < polygon.vertex_count; ++i) {
+		x += polygon.vertices[i].x;
+		y += polygon.vertices[i].y;
+	}
+	x /= polygon.vertex_count;
+	y /= polygon.vertex_count;
+}
+
+// Pixel bounds of the triangles |polygon| renders, padded by a pixel for smoothed edges.
+inline
+Rect PolygonBounds(const Poly &polygon, const TiledImage &image) {
+	Rect rect = {};
+	Triangulate(polygon);
+	if (polygon.triangle_count == 0)
+		return rect;
+
+	Rect image_rect = { 0, 0, static_cast<int>(image.width), static_cast<int>(image.height) };
+	rect.left = static_cast<int>(floor(polygon.min.x * image.width)) - 1;
+	rect.bottom = static_cast<int>(floor(polygon.min.y * image.height)) - 1;
+	rect.right = static_cast<int>(ceil(polygon.max.x * image.width)) + 1;
+	rect.top = static_cast<int>(ceil(polygon.max.y * image.height)) + 1;
+	return IntersectRect(rect, image_rect);
+}
+
+inline
+bool IsIndexed(const GeneImage &gene_image) {
+	return gene_image.index.cells_x > 0;
+}
+
+// Rebins polygon |i| after its geometry changed.
+inline
+void UpdatePolygonBounds(GeneImage *gene_image, int i) {
+	if (IsIndexed(*gene_image))
+		UpdatePolygonIndex(&gene_image->index, i, PolygonBounds(gene_image->gene[i], gene_image->composite));
+}
+
+// Rebuilds the index after the whole gene was replaced or changed.
+inline
+void RebuildPolygonIndex(GeneImage *gene_image) {
+	if (!IsIndexed(*gene_image))
+		return;
+
+	ClearPolygonIndex(&gene_image->index);
+	for (int i = 0; i < gene_image->polygon_count; ++i) {
+		AppendPolygonIndex(&gene_image->index, PolygonBounds(gene_image->gene[i], gene_image->composite));
+	}
+}
+
+// Inserts vertices near the worst fitting cells around the polygon, or anywhere in
+// the image if the polygon has no area to search around.
+inline
+void AddVertex(SimulationState &state, Poly &polygon, int num) {
+	const ResidualMap &residual = state.residual;
+
+	Rect bounds = PolygonBounds(polygon, state.source_image);
+	bool whole_image = IsEmpty(bounds);
+	int margin_x = (bounds.right - bounds.left) / 2;
+	int margin_y = (bounds.top - bounds.bottom) / 2;
+	int min_x = std::max(0, (bounds.left - margin_x) / residual.cell_size);
+	int min_y = std::max(0, (bounds.bottom - margin_y) / residual.cell_size);
+	int max_x = std::min(residual.cells_x, (bounds.right + margin_x) / residual.cell_size + 1);
+	int max_y = std::min(residual.cells_y, (bounds.top + margin_y) / residual.cell_size + 1);
+
+	Vertex *prev_vertices = polygon.vertices;
+	polygon.vertices = new Vertex[polygon.vertex_count + num];
+
+	CopyVertices(polygon.vertices, prev_vertices, polygon.vertex_count);
+
+	for (int i = 0; i < num; ++i) {
+		float center_x, center_y;
+		std::lock_guard<std::mutex> guard(state.residual_lock);
+		if (whole_image) {
+			SampleResidual(&state.residual, state.source_image, &center_x, &center_y);
+		} else {
+			SampleResidualRect(residual, min_x, min_y, max_x, max_y, state.source_image,
+				&center_x, &center_y);
+		}
+		InitRandomVertex(polygon.vertices[polygon.vertex_count + i], center_x, center_y);
+	}
+
+	polygon.vertex_count += num;
+	InvalidateTriangulation(polygon);
+
+	delete[] prev_vertices;
+}
+
+inline
+void RemoveVertex(Poly &polygon, int num) {
+	// TODO(orglofch): fix for num
+	Vertex *prev_vertices = polygon.vertices;
+	polygon.vertices = new Vertex[polygon.vertex_count - 1];
+
+	int index = rand() % polygon.vertex_count;
+	CopyVertices(polygon.vertices, prev_vertices, index);
+	CopyVertices(polygon.vertices + index, prev_vertices + index + 1,
+		polygon.vertex_count - index - 1);
+
+	polygon.vertex_count -= 1;
+	InvalidateTriangulation(polygon);
+
+	delete[] prev_vertices;
+}
+
+inline
+void SwapVertex(Poly &polygon) {
+	int i1 = rand() % polygon.vertex_count;
+	int i2 = rand() % polygon.vertex_count;
+
+	Vertex temp;
+	CopyVertex(temp, polygon.vertices[i1]);
+	CopyVertex(polygon.vertices[i1], polygon.vertices[i2]);
+	CopyVertex(polygon.vertices[i2], temp);
+	InvalidateTriangulation(polygon);
+}
+
+// Makes room for at least |capacity| polygons. The gene grows geometrically,
+// so appending polygons one at a time only reallocates it occasionally.
+inline
+void ReserveGene(GeneImage *gene_image, int capacity) {
+	if (capacity <= gene_image->polygon_capacity)
+		return;
+
+	capacity = std::max(capacity, 2 * gene_image->polygon_capacity);
+	Poly *prev_gene = gene_image->gene;
+	gene_image->gene = new Poly[capacity];
+	gene_image->polygon_capacity = capacity;
+	MovePolygons(gene_image->gene, prev_gene, gene_image->polygon_count);
+
+	if (prev_gene)
+		delete[] prev_gene;
+}
+
+// Replaces the gene with a copy of |polygons|. The caller rebuilds the index.
+inline
+void AssignGene(GeneImage *gene_image, const Poly *polygons, int polygon_count) {
+	gene_image->polygon_count = 0;
+	ReserveGene(gene_image, polygon_count);
+	CopyPolygons(gene_image->gene, polygons, polygon_count);
+	gene_image->polygon_count = polygon_count;
+}
+
+inline
+void AppendPolygon(GeneImage *gene_image, const Poly &polygon) {
+	ReserveGene(gene_image, gene_image->polygon_count + 1);
+	CopyPolygon(gene_image->gene[gene_image->polygon_count], polygon);
+
+	gene_image->polygon_count += 1;
+	if (IsIndexed(*gene_image))
+		AppendPolygonIndex(&gene_image->index, PolygonBounds(polygon, gene_image->composite));
+}
+
+inline
+void RemovePolygonAt(GeneImage *gene_image, int index) {
+	// Swaps the removed polygon along to the end, where its slot is reused by the next append.
+	for (int i = index; i + 1 < gene_image->polygon_count; ++i) {
+		MovePolygon(gene_image->gene[i], gene_image->gene[i + 1]);
+	}
+
+	gene_image->polygon_count -= 1;
+	if (IsIndexed(*gene_image))
+		RemovePolygonIndex(&gene_image->index, index);
+}
+
+inline
+void SwapPolygonsAt(GeneImage *gene_image, int i1, int i2) {
+	Poly temp;
+	MovePolygon(temp, gene_image->gene[i1]);
+	MovePolygon(gene_image->gene[i1], gene_image->gene[i2]);
+	MovePolygon(gene_image->gene[i2], temp);
+	if (IsIndexed(*gene_image))
+		SwapPolygonIndex(&gene_image->index, i1, i2);
+}
+
+inline
+bool ShouldMutate(float rate) {
+	float prob = Randf(0, 1);
+	return prob <= rate;
+}
+
+inline
+void MutatePolygon(SimulationState &state, Poly &polygon, double sigma_modifier, double rate_modifier) {
+	if (polygon.vertex_count > 3 && ShouldMutate(kRemoveVertexRate)) {
+		RemoveVertex(polygon, 1);
+	} else if (polygon.vertex_count < kMaxVertices && ShouldMutate(kAddVertexRate)) {
+		AddVertex(state, polygon, 1);
+	} else if (polygon.vertex_count > 1 && ShouldMutate(kSwapVertexRate)) {
+		SwapVertex(polygon);
+	} else {
+		std::default_random_engine &generator = state.random;
+		std::normal_distribution<float> red_dist(0, kRedMutationSigma * sigma_modifier);
+		if (ShouldMutate(kRedMutationRate * rate_modifier)) {
+			float value = red_dist(generator);
+			polygon.colour.r += value;
+			clamp(&polygon.colour.r, kRedMin, kRedMax);
+		}
+		std::normal_distribution<float> green_dist(0, kGreenMutationSigma * sigma_modifier);
+		if (ShouldMutate(kGreenMutationRate * rate_modifier)) {
+			float value = green_dist(generator);
+			polygon.colour.g += value;
+			clamp(&polygon.colour.g, kGreenMin, kGreenMax);
+		}
+		std::normal_distribution<float> blue_dist(0, kBlueMutationSigma * sigma_modifier);
+		if (ShouldMutate(kBlueMutationRate * rate_modifier)) {
+			float value = blue_dist(generator);
+			polygon.colour.b += value;
+			clamp(&polygon.colour.b, kBlueMin, kBlueMax);
+		}
+		std::normal_distribution<float> alpha_dist(0, kAlphaMutationSigma * sigma_modifier);
+		if (ShouldMutate(kAlphaMutationRate * rate_modifier)) {
+			float value = alpha_dist(generator);
+			polygon.colour.a += value;
+			clamp(&polygon.colour.a, kAlphaMin, kAlphaMax);
+		}
+		std::normal_distribution<float> vertex_dist(0, kVertexMutationSigma * sigma_modifier);
+		bool moved = false;
+		for (int i = 0; i < polygon.vertex_count; ++i) {
+			Vertex &vertex = polygon.vertices[i];
+			if (ShouldMutate(kVertexMutationRate * rate_modifier)) {
+				float value = vertex_dist(generator);
+				vertex.x += value;
+				clamp(&vertex.x, kVertexMin, kVertexMax);
+				moved = true;
+			}
+			if (ShouldMutate(kVertexMutationRate * rate_modifier)) {
+				float value = vertex_dist(generator);
+				vertex.y += value;
+				clamp(&vertex.y, kVertexMin, kVertexMax);
+				moved = true;
+			}
+		}
+		// Colour changes keep the cached triangulation.
+		if (moved)
+			InvalidateTriangulation(polygon);
+	}
+}
+
+inline
+void RenderPolygon(const Poly &polygon, int width, int height) {
+	Triangulate(polygon);
+
+	glColor4f(polygon.colour.r, polygon.colour.g, polygon.colour.b, polygon.colour.a);
+	glBegin(GL_TRIANGLES);
+		for (int i = 0; i < polygon.triangle_count * 3; ++i) {
+			const Vertex &vertex = polygon.triangles[i];
+			glVertex2f(vertex.x * width, vertex.y * height);
+		}
+	glEnd();
+}
+
+inline
+void Render(const GeneImage &gene_image) {
+	for (int i = 0; i < gene_image.polygon_count; ++i) {
+		RenderPolygon(gene_image.gene[i], gene_image.composite.width, gene_image.composite.height);
+	}
+}
+
+// Renders the polygons of |gene_image| in |polygons|.
+inline
+void RenderPolygons(const GeneImage &gene_image, const std::vector<int> &polygons) {
+	for (size_t i = 0; i < polygons.size(); ++i) {
+		RenderPolygon(gene_image.gene[polygons[i]], gene_image.composite.width, gene_image.composite.height);
+	}
+}
+
+// Renders the polygons of |gene_image| in |polygons| as though |candidate| had been applied to them.
+inline
+void RenderCandidate(const GeneImage &gene_image, const Candidate &candidate, const std::vector<int> &polygons) {
+	int width = gene_image.composite.width;
+	int height = gene_image.composite.height;
+	for (size_t j = 0; j < polygons.size(); ++j) {
+		int i = polygons[j];
+		const Poly *polygon = &gene_image.gene[i];
+		if (i == candidate.index) {
+			if (candidate.kind == kRemovePolygon)
+				continue;
+			if (candidate.kind == kModifyPolygon)
+				polygon = &candidate.polygon;
+			if (candidate.kind == kSwapPolygon)
+				polygon = &gene_image.gene[candidate.other_index];
+		} else if (i == candidate.other_index && candidate.kind == kSwapPolygon) {
+			polygon = &gene_image.gene[candidate.index];
+		}
+		RenderPolygon(*polygon, width, height);
+	}
+	if (candidate.kind == kAddPolygon)
+		RenderPolygon(candidate.polygon, width, height);
+}
+
+inline
+GLenum PixelFormat(int channels) {
+	switch (channels)
+	{
+		case 1:
+			return GL_RED;
+		case 3:
+			return GL_RGB;
+		default:
+			return GL_RGBA;
+	}
+}
+
+inline
+void ReadBuffer(float *buffer, int width, int height, int stride, int channels) {
+	glPixelStorei(GL_PACK_ROW_LENGTH, stride);
+	glReadPixels(0, 0, width, height, PixelFormat(channels), GL_FLOAT, buffer);
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+}
+
+inline
+void RenderRect(SimulationState &state, const Rect &rect, float *buffer, int stride,
+	            const Candidate *candidate = NULL) {
+	int width = rect.right - rect.left;
+	int height = rect.top - rect.bottom;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, state.tile_framebuffer);
+	glViewport(0, 0, width, height);
+	glSetOrthographicProjection(rect.left, rect.right, rect.bottom, rect.top, -1, 1);
+
+	// The candidate's polygons may move into the rect, so they're always rendered.
+	std::vector<int> &polygons = state.render_list;
+	QueryPolygonIndex(&state.gene_image.index, rect, &polygons);
+	if (candidate && candidate->kind != kAddPolygon) {
+		polygons.push_back(candidate->index);
+		if (candidate->kind == kSwapPolygon)
+			polygons.push_back(candidate->other_index);
+		std::sort(polygons.begin(), polygons.end());
+		polygons.erase(std::unique(polygons.begin(), polygons.end()), polygons.end());
+	}
+
+	glClear(GL_COLOR_BUFFER_BIT);
+	if (candidate) {
+		RenderCandidate(state.gene_image, *candidate, polygons);
+	} else {
+		RenderPolygons(state.gene_image, polygons);
+	}
+	ReadBuffer(buffer, width, height, stride, state.gene_image.composite.channels);
+}
+
+inline
+void RenderTile(SimulationState &state, unsigned int tx, unsigned int ty, float *buffer) {
+	const TiledImage &composite = state.gene_image.composite;
+	RenderRect(state, TileRect(composite, tx, ty), buffer, composite.tile_size);
+}
+
+// Renders the gene into the composite one tile at a time and
+// scores each tile against the matching source tile.
+inline
+double RenderAndScore(SimulationState &state) {
+	TiledImage &composite = state.gene_image.composite;
+
+	ClearCandidateError(&state.residual);
+
+	double error = 0;
+	for (unsigned int ty = 0; ty < composite.tiles_y; ++ty) {
+		for (unsigned int tx = 0; tx < composite.tiles_x; ++tx) {
+			float *composite_data = AcquireTile(&composite, tx, ty);
+			const float *source_data = AcquireTile(&state.source_image, tx, ty);
+			if (!composite_data || !source_data)
+				continue;
+
+			RenderTile(state, tx, ty, composite_data);
+			error += AccumulateCellError(state.residual, source_data, composite_data, composite.tile_size,
+				TileRect(composite, tx, ty), composite.channels, state.residual.candidate_error);
+		}
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	return error / (static_cast<double>(composite.width) * composite.height *
+		ColourChannels(composite.channels));
+}
+
+// Error of the current composite within |rect|.
+inline
+double CompositeError(SimulationState &state, const Rect &rect) {
+	TiledImage &composite = state.gene_image.composite;
+
+	double error = 0;
+	ForEachTileRect(composite, rect, [&](unsigned int tx, unsigned int ty, const Rect &piece) {
+		int offset = TileOffset(composite, tx, ty, piece);
+		const float *composite_data = AcquireTile(&composite, tx, ty);
+		const float *source_data = AcquireTile(&state.source_image, tx, ty);
+		if (!composite_data || !source_data)
+			return;
+
+		error += RegionError(source_data + offset, composite.tile_size, composite_data + offset,
+			composite.tile_size, piece.right - piece.left, piece.top - piece.bottom, composite.channels);
+	});
+	return error;
+}
+
+// Whether all of |rect| fits in a tile sized scratch buffer.
+inline
+bool FitsScratch(const TiledImage &composite, const Rect &rect) {
+	return static_cast<long long>(rect.right - rect.left) * (rect.top - rect.bottom) <=
+		static_cast<long long>(composite.tile_size) * composite.tile_size;
+}
+
+// Error of the current gene within |rect| without touching the composite. |scratch| is tile sized.
+// When |rect| fits in it, it's left holding all of |rect|, |rect| wide, see CommitScratchRect().
+inline
+double RenderRectError(SimulationState &state, const Rect &rect, float *scratch,
+	                   const Candidate *candidate = NULL) {
+	TiledImage &composite = state.gene_image.composite;
+	bool whole_rect = FitsScratch(composite, rect);
+	int rect_width = rect.right - rect.left;
+
+	double error = 0;
+	ForEachTileRect(composite, rect, [&](unsigned int tx, unsigned int ty, const Rect &piece) {
+		const float *source_data = AcquireTile(&state.source_image, tx, ty);
+		if (!source_data)
+			return;
+
+		int width = piece.right - piece.left;
+		float *rendered = scratch;
+		int stride = width;
+		if (whole_rect) {
+			rendered += ((piece.bottom - rect.bottom) * rect_width + piece.left - rect.left) * composite.channels;
+			stride = rect_width;
+		}
+		RenderRect(state, piece, rendered, stride, candidate);
+		error += RegionError(source_data + TileOffset(composite, tx, ty, piece), composite.tile_size,
+			rendered, stride, width, piece.top - piece.bottom, composite.channels);
+	});
+	return error;
+}
+
+inline
+void CommitRect(SimulationState &state, const Rect &rect) {
+	TiledImage &composite = state.gene_image.composite;
+	ForEachTileRect(composite, rect, [&](unsigned int tx, unsigned int ty, const Rect &piece) {
+		float *composite_data = AcquireTile(&composite, tx, ty);
+		if (composite_data)
+			RenderRect(state, piece, composite_data + TileOffset(composite, tx, ty, piece), composite.tile_size);
+	});
+}
+
+// Commits |rect| right after RenderRectError() scored it into |scratch|,
+// copying the rendered pixels rather than rendering them again when they were kept.
+inline
+void CommitScratchRect(SimulationState &state, const Rect &rect, const float *scratch) {
+	if (FitsScratch(state.gene_image.composite, rect)) {
+		WriteRect(&state.gene_image.composite, rect, scratch);
+	} else {
+		CommitRect(state, rect);
+	}
+}
+
+// Tries moving |value| by +-|step|, keeping the change if it lowers the error of
+// the polygon's bounds. |error| is the summed squared error of the whole composite.
+// Only vertex coordinates, |is_vertex|, affect the polygon's triangulation and bounds.
+inline
+bool TryLocalStep(SimulationState &state, int index, float *value, bool is_vertex, float step,
+	              float min_value, float max_value, float *scratch, double *error, int *evaluations) {
+	GeneImage &gene_image = state.gene_image;
+	const TiledImage &composite = gene_image.composite;
+	Poly &polygon = gene_image.gene[index];
+
+	Rect old_bounds = PolygonBounds(polygon, composite);
+	float old_value = *value;
+	for (int sign = -1; sign <= 1; sign += 2) {
+		*value = old_value + sign * step;
+		clamp(value, min_value, max_value);
+		if (state.quantize)
+			QuantizeGene(&polygon, 1, state.encoding);
+		if (*value == old_value)
+			continue;
+
+		if (is_vertex) {
+			InvalidateTriangulation(polygon);
+			UpdatePolygonBounds(&gene_image, index);
+		}
+
+		Rect bounds = UnionRect(old_bounds, PolygonBounds(polygon, composite));
+		double old_error = CompositeError(state, bounds);
+		double new_error = RenderRectError(state, bounds, scratch);
+		*evaluations += 1;
+
+		if (new_error < old_error) {
+			CommitScratchRect(state, bounds, scratch);
+			UpdateResidual(&state.residual, &state.source_image, &state.gene_image.composite, bounds);
+			*error += new_error - old_error;
+			return true;
+		}
+	}
+	*value = old_value;
+	if (is_vertex) {
+		InvalidateTriangulation(polygon);
+		UpdatePolygonBounds(&gene_image, index);
+	}
+	return false;
+}
+
+// Whether a tile of the source or composite couldn't be mapped, see AcquireTile().
+// Scores are meaningless from then on so the solver has to stop.
+inline
+bool TilesFailed(const SimulationState &state) {
+	return state.source_image.failed || state.gene_image.composite.failed;
+}
+
+// Re-renders the whole composite if the gene was replaced since it was last rendered.
+inline
+void SyncComposite(SimulationState &state) {
+	if (state.gene_image.composite_valid)
+		return;
+
+	state.gene_image.fitness = RenderAndScore(state);
+	AcceptCandidateError(&state.residual);
+	state.gene_image.composite_valid = true;
+}
+
+// Deterministic coordinate descent over every vertex coordinate and polygon alpha.
+// Each trial only re-renders and scores the bounds of the polygon being changed.
+// The step shrinks whenever a full sweep finds no improvement. Each call carries on from
+// the polygon and step the previous call stopped at, see SimulationState.
+inline
+void LocalSearch(SimulationState &state, int max_evaluations) {
+	GeneImage &gene_image = state.gene_image;
+	const TiledImage &composite = gene_image.composite;
+
+	double norm = static_cast<double>(composite.width) * composite.height *
+		ColourChannels(composite.channels);
+	SyncComposite(state);
+	double error = gene_image.fitness * norm;
+
+	float min_step = state.quantize ?
+		DequantizeUnit(1, state.encoding.vertex_bits) : kLocalSearchMinStep;
+	float alpha_min_step = state.quantize ? DequantizeUnit(1, 8) : kLocalSearchMinStep;
+
+	std::vector<float> scratch(composite.tile_size * composite.tile_size * composite.channels);
+
+	// A search which already converged starts over, as the gene has changed since.
+	if (state.local_search_step < min_step) {
+		state.local_search_polygon = 0;
+		state.local_search_step = kLocalSearchInitialStep;
+		state.local_search_improved = false;
+	}
+
+	int evaluations = 0;
+	float &step = state.local_search_step;
+	while (step >= min_step && evaluations < max_evaluations) {
+		int &i = state.local_search_polygon;
+		if (i >= gene_image.polygon_count) {
+			if (!state.local_search_improved)
+				step /= 2;
+			i = 0;
+			state.local_search_improved = false;
+			if (gene_image.polygon_count == 0)
+				break;
+			continue;
+		}
+
+		// A polygon cut short by the budget is searched again from its start next time.
+		bool improved = false;
+		Poly &polygon = gene_image.gene[i];
+		for (int j = 0; j < polygon.vertex_count && evaluations < max_evaluations; ++j) {
+			Vertex &vertex = polygon.vertices[j];
+			improved |= TryLocalStep(state, i, &vertex.x, true, step, kVertexMin, kVertexMax,
+				scratch.data(), &error, &evaluations);
+			improved |= TryLocalStep(state, i, &vertex.y, true, step, kVertexMin, kVertexMax,
+				scratch.data(), &error, &evaluations);
+		}
+		if (evaluations < max_evaluations) {
+			improved |= TryLocalStep(state, i, &polygon.colour.a, false, std::max(step, alpha_min_step),
+				kAlphaMin, kAlphaMax, scratch.data(), &error, &evaluations);
+			i += 1;
+		}
+		state.local_search_improved |= improved;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	gene_image.fitness = error / norm;
+	LOG("Local search: %d evaluations, fitness %f\n", evaluations, gene_image.fitness);
+}
+
+inline
+void ApplyCandidate(GeneImage *gene_image, const Candidate &candidate) {
+	switch (candidate.kind)
+	{
+		case kModifyPolygon:
+			CopyPolygon(gene_image->gene[candidate.index], candidate.polygon);
+			UpdatePolygonBounds(gene_image, candidate.index);
+			break;
+		case kAddPolygon:
+			AppendPolygon(gene_image, candidate.polygon);
+			break;
+		case kRemovePolygon:
+			RemovePolygonAt(gene_image, candidate.index);
+			break;
+		case kSwapPolygon:
+			SwapPolygonsAt(gene_image, candidate.index, candidate.other_index);
+			break;
+	}
+}
+
+inline
+Rect CandidateBounds(const GeneImage &gene_image, const Candidate &candidate) {
+	const TiledImage &composite = gene_image.composite;
+	switch (candidate.kind)
+	{
+		case kModifyPolygon:
+			return UnionRect(PolygonBounds(gene_image.gene[candidate.index], composite),
+				PolygonBounds(candidate.polygon, composite));
+		case kAddPolygon:
+			return PolygonBounds(candidate.polygon, composite);
+		case kRemovePolygon:
+			return PolygonBounds(gene_image.gene[candidate.index], composite);
+		default:
+			return UnionRect(PolygonBounds(gene_image.gene[candidate.index], composite),
+				PolygonBounds(gene_image.gene[candidate.other_index], composite));
+	}
+}
+
+inline
+bool PolygonsEqual(const Poly &p1, const Poly &p2) {
+	if (p1.vertex_count != p2.vertex_count ||
+		p1.colour.r != p2.colour.r || p1.colour.g != p2.colour.g ||
+		p1.colour.b != p2.colour.b || p1.colour.a != p2.colour.a) {
+		return false;
+	}
+	for (int i = 0; i < p1.vertex_count; ++i) {
+		if (p1.vertices[i].x != p2.vertices[i].x || p1.vertices[i].y != p2.vertices[i].y)
+			return false;
+	}
+	return true;
+}
+
+// Produces a single polygon change as a delta against |gene_image|.
+inline
+void GenerateCandidate(SimulationState &state, const GeneImage &gene_image, double fitness,
+	                   Candidate *candidate) {
+	int polygon_count = gene_image.polygon_count;
+	if (polygon_count > 1 && ShouldMutate(kRemovePolygonRate)) {
+		candidate->kind = kRemovePolygon;
+		candidate->index = rand() % polygon_count;
+	} else if (polygon_count == 0 || (polygon_count < kMaxPolygons && ShouldMutate(kAddPolygonRate))) {
+		candidate->kind = kAddPolygon;
+		InitRandomPolygon(state, candidate->polygon, 8);
+	} else if (polygon_count > 1 && ShouldMutate(kSwapPolygonRate)) {
+		candidate->kind = kSwapPolygon;
+		candidate->index = rand() % polygon_count;
+		candidate->other_index = (candidate->index + 1 + rand() % (polygon_count - 1)) % polygon_count;
+	} else {
+		// Mutates with the per polygon rates, retrying until something changed, so a
+		// candidate stays a small change however many polygons the gene holds.
+		candidate->kind = kModifyPolygon;
+		candidate->index = rand() % polygon_count;
+		const Poly &polygon = gene_image.gene[candidate->index];
+		CopyPolygon(candidate->polygon, polygon);
+		for (int i = 0; i < 100 && PolygonsEqual(candidate->polygon, polygon); ++i) {
+			MutatePolygon(state, candidate->polygon, 1.0 - fitness, 1.0 - fitness);
+		}
+	}
+	if (state.quantize)
+		QuantizeGene(&candidate->polygon, 1, state.encoding);
+}
+
+struct CommitRecord
+{
+	CandidateKind kind;
+	int index;
+	int other_index;
+	Rect bounds;
+};
+
+// Staged solver:
+//
+//   generator thread -> GL thread (render) -> scorer threads -> GL thread (commit)
+//
+// The generator mutates its own copy of the gene, kept in sync by the commits
+// sent back to it, so candidates may be based on an old gene version. Candidates
+// are rebased onto newer versions when no commit since touched the same polygon,
+// the polygon order or, once rendered, the same pixels. Otherwise they are discarded.
+struct Pipeline
+{
+	Pipeline() : candidates(kPipelineDepth), commits(kPipelineDepth), running(false),
+		version(0), error(0), norm(1), next_worker(0), in_flight(0), generator_version(0),
+		generator_fitness(0), total_scored(0), scored(0), discarded(0), accepted(0), stats_time(0) {}
+
+	~Pipeline() {
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			delete jobs[i];
+			delete results[i];
+		}
+	}
+
+	RingBuffer<Candidate*> candidates;
+	std::vector<RingBuffer<Candidate*>*> jobs;
+	std::vector<RingBuffer<Candidate*>*> results;
+	RingBuffer<Candidate*> commits;
+
+	std::atomic<bool> running;
+	std::thread generator;
+	std::vector<std::thread> scorers;
+
+	// Owned by the GL thread.
+	unsigned long long version;
+	CommitRecord log[kCommitLogSize];
+	double error;
+	double norm;
+	int next_worker;
+	int in_flight;
+	std::vector<float> scratch;
+
+	// Owned by the generator thread.
+	GeneImage generator_gene;
+	unsigned long long generator_version;
+	double generator_fitness;
+
+	long long total_scored;
+	int scored;
+	int discarded;
+	int accepted;
+	double stats_time;
+};
+
+// Whether |candidate| can be moved from |version| onto the latest gene.
+inline
+bool CanRebase(const Pipeline &pipeline, const Candidate &candidate, unsigned long long version,
+	           bool check_bounds) {
+	if (pipeline.version - version >= kCommitLogSize)
+		return false;
+
+	for (unsigned long long v = version + 1; v <= pipeline.version; ++v) {
+		const CommitRecord &commit = pipeline.log[v % kCommitLogSize];
+		// Anything but modifying a polygon changes the meaning of indices.
+		if (commit.kind != kModifyPolygon)
+			return false;
+		if (commit.index == candidate.index || commit.index == candidate.other_index)
+			return false;
+		if (check_bounds && !IsEmpty(IntersectRect(commit.bounds, candidate.bounds)))
+			return false;
+	}
+	return true;
+}
+
+inline
+void DrainCommits(Pipeline *pipeline) {
+	Candidate *commit;
+	while (TryPop(&pipeline->commits, &commit)) {
+		ApplyCandidate(&pipeline->generator_gene, *commit);
+		pipeline->generator_version = commit->render_version;
+		pipeline->generator_fitness = commit->fitness;
+		delete commit;
+	}
+}
+
+inline
+void GeneratorWorker(Pipeline *pipeline, SimulationState *state, unsigned int seed) {
+	srand(seed);
+
+	while (pipeline->running) {
+		DrainCommits(pipeline);
+
+		Candidate *candidate = new Candidate();
+		GenerateCandidate(*state, pipeline->generator_gene, pipeline->generator_fitness, candidate);
+		candidate->base_version = pipeline->generator_version;
+
+		// Keep applying commits while waiting so the GL thread is never blocked on us.
+		while (!TryPush(&pipeline->candidates, candidate)) {
+			if (!pipeline->running) {
+				delete candidate;
+				return;
+			}
+			DrainCommits(pipeline);
+			std::this_thread::yield();
+		}
+	}
+}
+
+inline
+void ScoreWorker(Pipeline *pipeline, int worker, int channels) {
+	while (pipeline->running) {
+		Candidate *candidate;
+		if (!TryPop(pipeline->jobs[worker], &candidate)) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		int width = candidate->bounds.right - candidate->bounds.left;
+		int height = candidate->bounds.top - candidate->bounds.bottom;
+		candidate->delta =
+			RegionError(candidate->source.data(), width, candidate->rendered.data(), width, width, height, channels) -
+			RegionError(candidate->source.data(), width, candidate->composite.data(), width, width, height, channels);
+
+		// Can't fail, the GL thread never has more than kPipelineDepth candidates in flight.
+		TryPush(pipeline->results[worker], candidate);
+	}
+}
+
+inline
+void StartPipeline(Pipeline *pipeline, SimulationState &state, int workers) {
+	const TiledImage &composite = state.gene_image.composite;
+	pipeline->norm = static_cast<double>(composite.width) * composite.height *
+		ColourChannels(composite.channels);
+	pipeline->error = RenderAndScore(state) * pipeline->norm;
+	state.gene_image.fitness = pipeline->error / pipeline->norm;
+	AcceptCandidateError(&state.residual);
+	state.gene_image.composite_valid = true;
+
+	pipeline->scratch.resize(composite.tile_size * composite.tile_size * composite.channels);
+
+	pipeline->generator_version = pipeline->version;
+	pipeline->generator_fitness = state.gene_image.fitness;
+	AssignGene(&pipeline->generator_gene, state.gene_image.gene, state.gene_image.polygon_count);
+
+	while (static_cast<int>(pipeline->jobs.size()) < workers) {
+		pipeline->jobs.push_back(new RingBuffer<Candidate*>(kPipelineDepth));
+		pipeline->results.push_back(new RingBuffer<Candidate*>(kPipelineDepth));
+	}
+
+	// Each start draws a different but reproducible stream from the state's seed.
+	unsigned int seed = state.seed + 0x9E3779B9u * state.pipeline_starts++;
+
+	pipeline->running = true;
+	pipeline->generator = std::thread(GeneratorWorker, pipeline, &state, seed);
+	for (int i = 0; i < workers; ++i) {
+		pipeline->scorers.push_back(std::thread(ScoreWorker, pipeline, i, composite.channels));
+	}
+}
+
+inline
+void StopPipeline(Pipeline *pipeline) {
+	if (!pipeline->running)
+		return;
+
+	pipeline->running = false;
+	pipeline->generator.join();
+	for (size_t i = 0; i < pipeline->scorers.size(); ++i) {
+		pipeline->scorers[i].join();
+	}
+	pipeline->scorers.clear();
+
+	Candidate *candidate;
+	while (TryPop(&pipeline->candidates, &candidate)) {
+		delete candidate;
+	}
+	while (TryPop(&pipeline->commits, &candidate)) {
+		delete candidate;
+	}
+	for (size_t i = 0; i < pipeline->jobs.size(); ++i) {
+		while (TryPop(pipeline->jobs[i], &candidate)) {
+			delete candidate;
+		}
+		while (TryPop(pipeline->results[i], &candidate)) {
+			delete candidate;
+		}
+	}
+	pipeline->in_flight = 0;
+}
+
+inline
+void CommitCandidate(Pipeline *pipeline, SimulationState &state, Candidate *candidate, float temperature) {
+	if (!CanRebase(*pipeline, *candidate, candidate->render_version, true)) {
+		pipeline->discarded += 1;
+		delete candidate;
+		return;
+	}
+
+	double new_error = pipeline->error + candidate->delta;
+	if (candidate->delta >= 0 && Randf(0, 1) >= BoltzmannProbability(pipeline->error / pipeline->norm,
+		new_error / pipeline->norm, temperature)) {
+		delete candidate;
+		return;
+	}
+
+	ApplyCandidate(&state.gene_image, *candidate);
+	if (candidate->rendered.empty()) {
+		CommitRect(state, candidate->bounds);
+	} else {
+		WriteRect(&state.gene_image.composite, candidate->bounds, candidate->rendered.data());
+	}
+	{
+		std::lock_guard<std::mutex> guard(state.residual_lock);
+		UpdateResidual(&state.residual, &state.source_image, &state.gene_image.composite, candidate->bounds);
+	}
+
+	pipeline->error = new_error;
+	state.gene_image.fitness = new_error / pipeline->norm;
+	pipeline->accepted += 1;
+
+	pipeline->version += 1;
+	CommitRecord &record = pipeline->log[pipeline->version % kCommitLogSize];
+	record.kind = candidate->kind;
+	record.index = candidate->index;
+	record.other_index = candidate->other_index;
+	record.bounds = candidate->bounds;
+
+	std::vector<float>().swap(candidate->rendered);
+	std::vector<float>().swap(candidate->composite);
+	std::vector<float>().swap(candidate->source);
+	// Tells the generator which version its gene is at once it applies the commit.
+	candidate->render_version = pipeline->version;
+	candidate->fitness = state.gene_image.fitness;
+	while (!TryPush(&pipeline->commits, candidate)) {
+		std::this_thread::yield();
+	}
+}
+
+// Commits any scored candidates then renders the next candidate for the scorers.
+// Must be called on the GL thread.
+inline
+void PipelineStep(Pipeline *pipeline, SimulationState &state, float temperature) {
+	for (size_t i = 0; i < pipeline->results.size(); ++i) {
+		Candidate *candidate;
+		while (TryPop(pipeline->results[i], &candidate)) {
+			pipeline->in_flight -= 1;
+			pipeline->scored += 1;
+			pipeline->total_scored += 1;
+			CommitCandidate(pipeline, state, candidate, temperature);
+		}
+	}
+
+	double time = glfwGetTime();
+	if (time - pipeline->stats_time >= 1.0) {
+		LOG("%d candidates/sec, %d accepted, %d discarded\n", pipeline->scored,
+			pipeline->accepted, pipeline->discarded);
+		pipeline->scored = 0;
+		pipeline->accepted = 0;
+		pipeline->discarded = 0;
+		pipeline->stats_time = time;
+	}
+
+	Candidate *candidate;
+	if (pipeline->in_flight >= kPipelineDepth || !TryPop(&pipeline->candidates, &candidate))
+		return;
+
+	if (!CanRebase(*pipeline, *candidate, candidate->base_version, false)) {
+		pipeline->discarded += 1;
+		delete candidate;
+		return;
+	}
+
+	candidate->bounds = CandidateBounds(state.gene_image, *candidate);
+	candidate->render_version = pipeline->version;
+	if (IsEmpty(candidate->bounds)) {
+		delete candidate;
+		return;
+	}
+
+	const Rect &bounds = candidate->bounds;
+	int width = bounds.right - bounds.left;
+	int height = bounds.top - bounds.bottom;
+	if (static_cast<int64_t>(width) * height > kMaxPipelineRectPixels) {
+		candidate->delta = RenderRectError(state, bounds, pipeline->scratch.data(), candidate) -
+			CompositeError(state, bounds);
+		pipeline->scored += 1;
+		pipeline->total_scored += 1;
+		CommitCandidate(pipeline, state, candidate, temperature);
+		return;
+	}
+
+	int channels = state.gene_image.composite.channels;
+	candidate->rendered.resize(width * height * channels);
+	candidate->composite.resize(width * height * channels);
+	candidate->source.resize(width * height * channels);
+
+	ForEachTileRect(state.gene_image.composite, bounds, [&](unsigned int tx, unsigned int ty, const Rect &piece) {
+		RenderRect(state, piece, candidate->rendered.data() +
+			((piece.bottom - bounds.bottom) * width + piece.left - bounds.left) * channels, width, candidate);
+	});
+	ReadRect(&state.gene_image.composite, bounds, candidate->composite.data());
+	ReadRect(&state.source_image, bounds, candidate->source.data());
+
+	TryPush(pipeline->jobs[pipeline->next_worker], candidate);
+	pipeline->next_worker = (pipeline->next_worker + 1) % pipeline->jobs.size();
+	pipeline->in_flight += 1;
+}
+
+inline
+void AdamStep(float *value, double gradient, float rate, float min_value, float max_value,
+	          float *m, float *v, float m_correction, float v_correction) {
+	*m = kAdamBeta1 * *m + (1 - kAdamBeta1) * static_cast<float>(gradient);
+	*v = kAdamBeta2 * *v + (1 - kAdamBeta2) * static_cast<float>(gradient * gradient);
+	*value -= rate * (*m / m_correction) / (sqrt(*v / v_correction) + kAdamEpsilon);
+	clamp(value, min_value, max_value);
+}
+
+// FNV-1a hash of a polygon's vertices, see AdamPolygon.
+inline
+uint64_t PolygonKey(const Poly &polygon) {
+	uint64_t hash = 14695981039346656037ull;
+	for (int i = 0; i < polygon.vertex_count; ++i) {
+		uint32_t bits[2];
+		memcpy(&bits[0], &polygon.vertices[i].x, sizeof(bits[0]));
+		memcpy(&bits[1], &polygon.vertices[i].y, sizeof(bits[1]));
+		hash = (hash ^ bits[0]) * 1099511628211ull;
+		hash = (hash ^ bits[1]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// Moves every colour, alpha and vertex of the gene at once with |steps| steps of Adam
+// on the gradient of the soft rasterizer, see soft_raster.hpp, split across |threads|.
+// Soft edges only approximate what GL draws, so the result is kept only if it lowers the fitness.
+// The refined gene is scored into the spare composite, so a worse one is dropped without
+// rendering the old gene again, and polygons untouched since the last refinement keep their moments.
+// Once glfwGetTime() passes |deadline|, if it isn't 0, or |cancel| is set, the steps stop
+// and the old gene is restored without rendering.
+inline
+void GradientRefine(SimulationState &state, int steps, int threads, double deadline,
+	                const std::atomic<bool> *cancel) {
+	GeneImage &gene_image = state.gene_image;
+	TiledImage &composite = gene_image.composite;
+	int polygon_count = gene_image.polygon_count;
+	if (polygon_count == 0 || steps <= 0)
+		return;
+
+	SoftImage &source = state.soft_source;
+	if (source.data.empty() && !DownsampleTiledImage(&state.source_image, kGradientMaxSize, &source))
+		return;
+
+	TiledImage &spare = state.spare_composite;
+	if (!spare.tiles && !InitTiledImage(&spare, composite.width, composite.height, composite.channels,
+		composite.max_resident * composite.tile_stride)) {
+		LOG("Failed to create the spare composite\n");
+		return;
+	}
+
+	SyncComposite(state);
+	double old_fitness = gene_image.fitness;
+
+	Poly *old_gene = new Poly[polygon_count];
+	CopyPolygons(old_gene, gene_image.gene, polygon_count);
+
+	std::unordered_map<uint64_t, int> previous;
+	for (size_t i = 0; i < state.adam.size(); ++i) {
+		previous[state.adam[i].key] = static_cast<int>(i);
+	}
+	std::vector<AdamPolygon> adam(polygon_count);
+	for (int i = 0; i < polygon_count; ++i) {
+		size_t parameters = 4 + gene_image.gene[i].vertex_count * 2;
+		std::unordered_map<uint64_t, int>::iterator it = previous.find(PolygonKey(gene_image.gene[i]));
+		if (it != previous.end() && state.adam[it->second].m.size() == parameters) {
+			std::swap(adam[i], state.adam[it->second]);
+		} else {
+			adam[i].m.assign(parameters, 0);
+			adam[i].v.assign(parameters, 0);
+		}
+	}
+
+	SoftScene scene;
+	SoftGradient gradient;
+	double soft_error = 0;
+	for (int step = 0; step < steps; ++step) {
+		if ((cancel && *cancel) || (deadline > 0 && glfwGetTime() >= deadline)) {
+			LOG("Gradient refinement stopped after %d of %d steps\n", step, steps);
+			CopyPolygons(gene_image.gene, old_gene, polygon_count);
+			RebuildPolygonIndex(&gene_image);
+			// The moments were taken out of |state| and have moved on since, so they're dropped.
+			state.adam.clear();
+			delete[] old_gene;
+			return;
+		}
+
+		BuildSoftScene(gene_image.gene, polygon_count, source.width, source.height, &scene);
+		ComputeSoftGradient(scene, source, threads, &gradient);
+		soft_error = gradient.error;
+
+		for (int i = 0; i < polygon_count; ++i) {
+			Poly &polygon = gene_image.gene[i];
+			AdamPolygon &moments = adam[i];
+			moments.steps += 1;
+			float m_correction = 1 - pow(kAdamBeta1, moments.steps);
+			float v_correction = 1 - pow(kAdamBeta2, moments.steps);
+			const double *parameters = &gradient.parameters[scene.polygons[i].first_parameter];
+			float *m = moments.m.data();
+			float *v = moments.v.data();
+
+			float *colour[3] = { &polygon.colour.r, &polygon.colour.g, &polygon.colour.b };
+			for (int c = 0; c < 3; ++c) {
+				AdamStep(colour[c], parameters[c], kGradientColourRate, 0, 1,
+					&m[c], &v[c], m_correction, v_correction);
+			}
+			AdamStep(&polygon.colour.a, parameters[3], kGradientColourRate, kAlphaMin, kAlphaMax,
+				&m[3], &v[3], m_correction, v_correction);
+
+			for (int j = 0, p = 4; j < polygon.vertex_count; ++j, p += 2) {
+				Vertex &vertex = polygon.vertices[j];
+				AdamStep(&vertex.x, parameters[p], kGradientVertexRate, kVertexMin, kVertexMax,
+					&m[p], &v[p], m_correction, v_correction);
+				AdamStep(&vertex.y, parameters[p + 1], kGradientVertexRate, kVertexMin, kVertexMax,
+					&m[p + 1], &v[p + 1], m_correction, v_correction);
+			}
+			// Only polygons whose triangles flipped are ear clipped again for the next step.
+			MoveTriangulation(polygon);
+		}
+	}
+
+	// Moved triangulations needn't be what ear clipping the final outlines gives, which GL draws.
+	for (int i = 0; i < polygon_count; ++i) {
+		InvalidateTriangulation(gene_image.gene[i]);
+	}
+	if (state.quantize)
+		QuantizeGene(gene_image.gene, polygon_count, state.encoding);
+	RebuildPolygonIndex(&gene_image);
+
+	SwapTiledImages(&composite, &spare);
+	EvictAllTiles(&spare);
+	double new_fitness = RenderAndScore(state);
+
+	LOG("Gradient refinement: %d steps, soft error %f, fitness %f -> %f\n", steps,
+		soft_error / (static_cast<double>(source.width) * source.height * source.channels),
+		old_fitness, new_fitness);
+
+	// A score from failed tiles is meaningless, so the old gene is kept then too.
+	if (TilesFailed(state) || new_fitness > old_fitness) {
+		SwapTiledImages(&composite, &spare);
+		// The failure is still reported, as the spare will be used again.
+		composite.failed |= spare.failed;
+		CopyPolygons(gene_image.gene, old_gene, polygon_count);
+		RebuildPolygonIndex(&gene_image);
+		// The moments led somewhere worse, so the next refinement starts afresh.
+		state.adam.clear();
+	} else {
+		AcceptCandidateError(&state.residual);
+		gene_image.fitness = new_fitness;
+		for (int i = 0; i < polygon_count; ++i) {
+			adam[i].key = PolygonKey(gene_image.gene[i]);
+		}
+		state.adam.swap(adam);
+	}
+	EvictAllTiles(&spare);
+	delete[] old_gene;
+}
+
+// Tries a single polygon change, only rendering and scoring the polygons overlapping it.
+inline
+void UpdateAndRender(SimulationState &state, float temperature, float dt) {
+	GeneImage &gene_image = state.gene_image;
+	const TiledImage &composite = gene_image.composite;
+	SyncComposite(state);
+
+	Candidate candidate;
+	GenerateCandidate(state, gene_image, gene_image.fitness, &candidate);
+	bool added_polygon = candidate.kind == kAddPolygon;
+
+	Rect bounds = CandidateBounds(gene_image, candidate);
+	if (!IsEmpty(bounds)) {
+		state.scratch.resize(composite.tile_size * composite.tile_size * composite.channels);
+		double norm = static_cast<double>(composite.width) * composite.height *
+			ColourChannels(composite.channels);
+		double delta = RenderRectError(state, bounds, state.scratch.data(), &candidate) -
+			CompositeError(state, bounds);
+		double new_fitness = gene_image.fitness + delta / norm;
+		if (delta < 0 ||
+			Randf(0, 1) < BoltzmannProbability(gene_image.fitness, new_fitness, temperature)) {
+			ApplyCandidate(&gene_image, candidate);
+			CommitScratchRect(state, bounds, state.scratch.data());
+			UpdateResidual(&state.residual, &state.source_image, &gene_image.composite, bounds);
+			gene_image.fitness = new_fitness;
+
+			state.accepted_added_polygons += added_polygon;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	state.added_polygons += added_polygon;
+	if (++state.iterations % 1000 == 0) {
+		LOG("Accepted %d of %d added polygons in the last 1000 iterations\n",
+			state.accepted_added_polygons, state.added_polygons);
+		state.added_polygons = 0;
+		state.accepted_added_polygons = 0;
+	}
+}
+
+inline
+bool InitGeneImage(SimulationState &state, const TiledImage &image, int polygons, int vertices,
+	               size_t memory_budget, GeneImage *gene_image) {
+	if (!InitTiledImage(&gene_image->composite, image.width, image.height, image.channels, memory_budget))
+		return false;
+	InitResidualMap(&state.residual, &state.source_image);
+
+	InitPolygonIndex(&gene_image->index, image.width, image.height);
+
+	ReserveGene(gene_image, polygons);
+	gene_image->polygon_count = polygons;
+	for (int i = 0; i < polygons; ++i) {
+		Poly &polygon = gene_image->gene[i];
+		InitRandomPolygon(state, polygon, vertices);
+	}
+	RebuildPolygonIndex(gene_image);
+	gene_image->composite_valid = false;
+	return true;
+}
+
+inline
+void InitGLState() {
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	glEnable(GL_POLYGON_SMOOTH);
+	glEnable(GL_MULTISAMPLE);
+	glShadeModel(GL_SMOOTH);
+
+	glEnable(GL_NORMALIZE);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_LIGHTING);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+// Runs a final local search on the quantized gene so the gene
+// which gets encoded is the one that was scored.
+inline
+void Polish(SimulationState &state, int evaluations) {
+	state.quantize = true;
+	QuantizeGene(state.gene_image.gene, state.gene_image.polygon_count, state.encoding);
+	RebuildPolygonIndex(&state.gene_image);
+	state.gene_image.composite_valid = false;
+
+	LocalSearch(state, evaluations);
+}
+
+inline
+bool SaveGene(const std::string &filename, const GeneImage &gene_image, const GeneEncoding &encoding) {
+	FILE *out = fopen(filename.c_str(), "wb");
+	if (!out) {
+		LOG("Unable to open %s\n", filename.c_str());
+		return false;
+	}
+
+	std::vector<uint8_t> data;
+	EncodeGene(gene_image.gene, gene_image.polygon_count, gene_image.composite.width,
+		gene_image.composite.height, encoding, &data);
+	bool written = fwrite(data.data(), 1, data.size(), out) == data.size();
+
+	fclose(out);
+	return written;
+}
+
+#endif
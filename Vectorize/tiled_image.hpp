@@ -0,0 +1,443 @@
+#ifndef _TILED_IMAGE_HPP_
+#define _TILED_IMAGE_HPP_
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <png.h>
+#include <string>
+
+#include "intrinsics.hpp"
+
+const unsigned int kTileSize = 1024;
+
+struct Tile
+{
+	Tile() : data(NULL), last_access(0) {}
+
+	float *data;
+	unsigned long long last_access;
+};
+
+// An image split into square tiles which live in a temporary memory-mapped file.
+// At most |max_resident| tiles are mapped at once, the least recently used
+// tile is unmapped to make room for a new one.
+//
+// Tile data is always |tile_size| floats wide per row regardless of whether the
+// tile lies on the image edge.
+struct TiledImage
+{
+	TiledImage() : width(0), height(0), channels(0), tile_size(kTileSize),
+		tiles_x(0), tiles_y(0), tile_stride(0), max_resident(0), resident_count(0),
+		access_clock(0), failed(false), file(INVALID_HANDLE_VALUE), mapping(NULL), tiles(NULL) {}
+
+	~TiledImage() {
+		if (tiles) {
+			for (unsigned int i = 0; i < tiles_x * tiles_y; ++i) {
+				if (tiles[i].data)
+					UnmapViewOfFile(tiles[i].data);
+			}
+			delete[] tiles;
+		}
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+	}
+
+	unsigned int width;
+	unsigned int height;
+	unsigned int channels;
+
+	unsigned int tile_size;
+	unsigned int tiles_x;
+	unsigned int tiles_y;
+
+	// Bytes between consecutive tiles in the backing file, rounded up
+	// to the allocation granularity so each tile can be mapped on its own.
+	size_t tile_stride;
+
+	size_t max_resident;
+	size_t resident_count;
+	unsigned long long access_clock;
+
+	// Set once a tile couldn't be mapped, after which the image's contents can't be trusted.
+	bool failed;
+
+	HANDLE file;
+	HANDLE mapping;
+	Tile *tiles;
+};
+
+inline
+bool InitTiledImage(TiledImage *image, unsigned int width, unsigned int height,
+	                unsigned int channels, size_t memory_budget) {
+	assert(!image->tiles);
+
+	image->width = width;
+	image->height = height;
+	image->channels = channels;
+	image->tiles_x = (width + image->tile_size - 1) / image->tile_size;
+	image->tiles_y = (height + image->tile_size - 1) / image->tile_size;
+
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	size_t granularity = system_info.dwAllocationGranularity;
+	size_t tile_bytes = image->tile_size * image->tile_size * channels * sizeof(float);
+	image->tile_stride = (tile_bytes + granularity - 1) / granularity * granularity;
+	image->max_resident = std::max<size_t>(1, memory_budget / image->tile_stride);
+
+	char temp_path[MAX_PATH];
+	char temp_file[MAX_PATH];
+	if (!GetTempPath(MAX_PATH, temp_path) ||
+		!GetTempFileName(temp_path, "vec", 0, temp_file)) {
+		LOG("Failed to create temporary tile file\n");
+		return false;
+	}
+
+	image->file = CreateFile(temp_file, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	if (image->file == INVALID_HANDLE_VALUE) {
+		LOG("Unable to open %s\n", temp_file);
+		return false;
+	}
+
+	unsigned long long file_size =
+		static_cast<unsigned long long>(image->tile_stride) * image->tiles_x * image->tiles_y;
+	image->mapping = CreateFileMapping(image->file, NULL, PAGE_READWRITE,
+		static_cast<DWORD>(file_size >> 32), static_cast<DWORD>(file_size & 0xFFFFFFFF), NULL);
+	if (!image->mapping) {
+		LOG("Failed to map %s\n", temp_file);
+		return false;
+	}
+
+	image->tiles = new Tile[image->tiles_x * image->tiles_y];
+	return true;
+}
+
+inline
+void EvictTile(TiledImage *image) {
+	Tile *lru = NULL;
+	for (unsigned int i = 0; i < image->tiles_x * image->tiles_y; ++i) {
+		Tile &tile = image->tiles[i];
+		if (tile.data && (!lru || tile.last_access < lru->last_access))
+			lru = &tile;
+	}
+	assert(lru);
+
+	UnmapViewOfFile(lru->data);
+	lru->data = NULL;
+	image->resident_count -= 1;
+}
+
+// Unmaps every tile, so an image which is set aside doesn't count against the memory budget.
+inline
+void EvictAllTiles(TiledImage *image) {
+	while (image->resident_count > 0)
+		EvictTile(image);
+}
+
+// Exchanges the contents of two images in constant time, tiles and backing files included.
+inline
+void SwapTiledImages(TiledImage *image1, TiledImage *image2) {
+	std::swap(image1->width, image2->width);
+	std::swap(image1->height, image2->height);
+	std::swap(image1->channels, image2->channels);
+	std::swap(image1->tile_size, image2->tile_size);
+	std::swap(image1->tiles_x, image2->tiles_x);
+	std::swap(image1->tiles_y, image2->tiles_y);
+	std::swap(image1->tile_stride, image2->tile_stride);
+	std::swap(image1->max_resident, image2->max_resident);
+	std::swap(image1->resident_count, image2->resident_count);
+	std::swap(image1->access_clock, image2->access_clock);
+	std::swap(image1->failed, image2->failed);
+	std::swap(image1->file, image2->file);
+	std::swap(image1->mapping, image2->mapping);
+	std::swap(image1->tiles, image2->tiles);
+}
+
+// Returns the data of tile (|tx|, |ty|), mapping it in if necessary, or NULL and
+// marks the image as failed if it can't be mapped.
+// The pointer is only valid until the next call to AcquireTile on the same image.
+inline
+float *AcquireTile(TiledImage *image, unsigned int tx, unsigned int ty) {
+	assert(tx < image->tiles_x && ty < image->tiles_y);
+
+	Tile &tile = image->tiles[ty * image->tiles_x + tx];
+	tile.last_access = ++image->access_clock;
+	if (tile.data)
+		return tile.data;
+
+	if (image->resident_count >= image->max_resident)
+		EvictTile(image);
+
+	unsigned long long offset =
+		static_cast<unsigned long long>(image->tile_stride) * (ty * image->tiles_x + tx);
+	tile.data = static_cast<float*>(MapViewOfFile(image->mapping, FILE_MAP_ALL_ACCESS,
+		static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset & 0xFFFFFFFF),
+		image->tile_stride));
+	if (!tile.data) {
+		LOG("Failed to map tile %u, %u\n", tx, ty);
+		image->failed = true;
+		return NULL;
+	}
+
+	image->resident_count += 1;
+	return tile.data;
+}
+
+inline
+void TileExtent(const TiledImage &image, unsigned int tx, unsigned int ty,
+	            unsigned int *width, unsigned int *height) {
+	*width = std::min(image.tile_size, image.width - tx * image.tile_size);
+	*height = std::min(image.tile_size, image.height - ty * image.tile_size);
+}
+
+// Pixel rectangle with exclusive |right| and |top|.
+struct Rect
+{
+	int left, bottom, right, top;
+};
+
+inline
+Rect TileRect(const TiledImage &image, unsigned int tx, unsigned int ty) {
+	unsigned int width, height;
+	TileExtent(image, tx, ty, &width, &height);
+
+	Rect rect;
+	rect.left = tx * image.tile_size;
+	rect.bottom = ty * image.tile_size;
+	rect.right = rect.left + width;
+	rect.top = rect.bottom + height;
+	return rect;
+}
+
+inline
+bool IsEmpty(const Rect &rect) {
+	return rect.left >= rect.right || rect.bottom >= rect.top;
+}
+
+inline
+Rect UnionRect(const Rect &r1, const Rect &r2) {
+	if (IsEmpty(r1))
+		return r2;
+	if (IsEmpty(r2))
+		return r1;
+
+	Rect rect;
+	rect.left = std::min(r1.left, r2.left);
+	rect.bottom = std::min(r1.bottom, r2.bottom);
+	rect.right = std::max(r1.right, r2.right);
+	rect.top = std::max(r1.top, r2.top);
+	return rect;
+}
+
+inline
+Rect IntersectRect(const Rect &r1, const Rect &r2) {
+	Rect rect;
+	rect.left = std::max(r1.left, r2.left);
+	rect.bottom = std::max(r1.bottom, r2.bottom);
+	rect.right = std::min(r1.right, r2.right);
+	rect.top = std::min(r1.top, r2.top);
+	return rect;
+}
+
+// Calls |fn| with each piece of |rect| which lies within a single tile.
+template <typename Fn>
+void ForEachTileRect(const TiledImage &image, const Rect &rect, Fn fn) {
+	if (IsEmpty(rect))
+		return;
+
+	for (unsigned int ty = rect.bottom / image.tile_size; ty <= (rect.top - 1) / image.tile_size; ++ty) {
+		for (unsigned int tx = rect.left / image.tile_size; tx <= (rect.right - 1) / image.tile_size; ++tx) {
+			fn(tx, ty, IntersectRect(rect, TileRect(image, tx, ty)));
+		}
+	}
+}
+
+inline
+int TileOffset(const TiledImage &image, unsigned int tx, unsigned int ty, const Rect &piece) {
+	return ((piece.bottom - ty * image.tile_size) * image.tile_size +
+		piece.left - tx * image.tile_size) * image.channels;
+}
+
+// Copies |rect| of |image| into a buffer |rect| wide.
+// Returns false if any of its tiles couldn't be mapped.
+inline
+bool ReadRect(TiledImage *image, const Rect &rect, float *buffer) {
+	int stride = rect.right - rect.left;
+	bool read = true;
+	ForEachTileRect(*image, rect, [&](unsigned int tx, unsigned int ty, const Rect &piece) {
+		const float *data = AcquireTile(image, tx, ty);
+		if (!data) {
+			read = false;
+			return;
+		}
+		data += TileOffset(*image, tx, ty, piece);
+		int width = (piece.right - piece.left) * image->channels;
+		for (int y = piece.bottom; y < piece.top; ++y) {
+			std::copy(data, data + width, buffer +
+				((y - rect.bottom) * stride + piece.left - rect.left) * image->channels);
+			data += image->tile_size * image->channels;
+		}
+	});
+	return read;
+}
+
+// Copies a buffer |rect| wide into |rect| of |image|.
+// Returns false if any of its tiles couldn't be mapped.
+inline
+bool WriteRect(TiledImage *image, const Rect &rect, const float *buffer) {
+	int stride = rect.right - rect.left;
+	bool written = true;
+	ForEachTileRect(*image, rect, [&](unsigned int tx, unsigned int ty, const Rect &piece) {
+		float *data = AcquireTile(image, tx, ty);
+		if (!data) {
+			written = false;
+			return;
+		}
+		data += TileOffset(*image, tx, ty, piece);
+		int width = (piece.right - piece.left) * image->channels;
+		for (int y = piece.bottom; y < piece.top; ++y) {
+			const float *row = buffer + ((y - rect.bottom) * stride + piece.left - rect.left) * image->channels;
+			std::copy(row, row + width, data);
+			data += image->tile_size * image->channels;
+		}
+	});
+	return written;
+}
+
+inline
+bool ReadPixel(TiledImage *image, unsigned int x, unsigned int y, float *pixel) {
+	const float *data = AcquireTile(image, x / image->tile_size, y / image->tile_size);
+	if (!data)
+		return false;
+
+	int index = ((y % image->tile_size) * image->tile_size + x % image->tile_size) * image->channels;
+	for (unsigned int c = 0; c < image->channels; ++c) {
+		pixel[c] = data[index + c];
+	}
+	return true;
+}
+
+// Streams a PNG into |image| one row at a time so the full image is never resident.
+// Like LoadPNG rows are stored bottom up.
+//
+// Every PNG row spans a whole row of tiles, so a row of tiles is kept resident while loading
+// even if that exceeds the budget, rather than remapping every tile for every PNG row.
+inline
+bool LoadPNGTiled(const std::string &filename, TiledImage *image, size_t memory_budget) {
+	png_byte buf[8];
+
+	FILE* in = fopen(filename.c_str(), "rb");
+	if (!in) {
+		LOG("Unable to open %s\n", filename.c_str());
+		return false;
+	}
+
+	if (fread(buf, 1, 8, in) != 8 || png_sig_cmp(buf, 0, 8)) {
+		LOG("Bad PNG signature %s\n", filename.c_str());
+		fclose(in);
+		return false;
+	}
+
+	png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+	if (!png_ptr) {
+		LOG("Failed to acquire png_ptr %s\n", filename.c_str());
+		fclose(in);
+		return false;
+	}
+
+	png_infop info_ptr = png_create_info_struct(png_ptr);
+	if (!info_ptr) {
+		LOG("Failed to acquire info_ptr %s\n", filename.c_str());
+		png_destroy_read_struct(&png_ptr, 0, 0);
+		fclose(in);
+		return false;
+	}
+
+	png_bytep row = NULL;
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		LOG("Failed to setjmp %s\n", filename.c_str());
+		delete[] row;
+		png_destroy_read_struct(&png_ptr, &info_ptr, 0);
+		fclose(in);
+		return false;
+	}
+
+	png_init_io(png_ptr, in);
+	png_set_sig_bytes(png_ptr, 8);
+	png_read_info(png_ptr, info_ptr);
+
+	if (png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE) {
+		LOG("Interlaced PNGs can't be streamed %s\n", filename.c_str());
+		png_destroy_read_struct(&png_ptr, &info_ptr, 0);
+		fclose(in);
+		return false;
+	}
+
+	int colour_type = png_get_color_type(png_ptr, info_ptr);
+	if (colour_type == PNG_COLOR_TYPE_PALETTE)
+		png_set_palette_to_rgb(png_ptr);
+	if (colour_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+		png_set_strip_alpha(png_ptr);
+	if (png_get_bit_depth(png_ptr, info_ptr) < 8)
+		png_set_expand_gray_1_2_4_to_8(png_ptr);
+	png_set_strip_16(png_ptr);
+	png_read_update_info(png_ptr, info_ptr);
+
+	unsigned int width = png_get_image_width(png_ptr, info_ptr);
+	unsigned int height = png_get_image_height(png_ptr, info_ptr);
+	unsigned int channels = png_get_channels(png_ptr, info_ptr);
+
+	if (!InitTiledImage(image, width, height, channels, memory_budget)) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, 0);
+		fclose(in);
+		return false;
+	}
+
+	size_t max_resident = image->max_resident;
+	image->max_resident = std::max<size_t>(max_resident, image->tiles_x);
+
+	row = new png_byte[png_get_rowbytes(png_ptr, info_ptr)];
+	for (unsigned int y = 0; y < height && !image->failed; ++y) {
+		png_read_row(png_ptr, row, NULL);
+
+		unsigned int image_y = height - y - 1;
+		unsigned int ty = image_y / image->tile_size;
+		unsigned int row_offset = (image_y % image->tile_size) * image->tile_size;
+		for (unsigned int tx = 0; tx < image->tiles_x; ++tx) {
+			float *data = AcquireTile(image, tx, ty);
+			if (!data)
+				break;
+
+			unsigned int tile_width, tile_height;
+			TileExtent(*image, tx, ty, &tile_width, &tile_height);
+			for (unsigned int x = 0; x < tile_width; ++x) {
+				unsigned int image_x = tx * image->tile_size + x;
+				for (unsigned int c = 0; c < channels; ++c) {
+					data[(row_offset + x) * channels + c] = row[image_x * channels + c] / 255.0f;
+				}
+			}
+		}
+	}
+
+	image->max_resident = max_resident;
+	while (image->resident_count > image->max_resident)
+		EvictTile(image);
+
+	delete[] row;
+	png_destroy_read_struct(&png_ptr, &info_ptr, 0);
+	fclose(in);
+
+	if (image->failed)
+		LOG("Failed to load %s into tiles\n", filename.c_str());
+	return !image->failed;
+}
+
+#endif
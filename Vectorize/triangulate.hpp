@@ -0,0 +1,306 @@
+#ifndef _TRIANGULATE_HPP_
+#define _TRIANGULATE_HPP_
+
+#include <algorithm>
+#include <vector>
+
+#include "gene.hpp"
+
+// Polygon triangulation shared by every renderer.
+//
+// A polygon's vertices are its outline, in either winding. Simple outlines are
+// ear clipped, whereas self-intersecting ones (which have no well defined interior)
+// are replaced by their convex hull. Either way the triangles never overlap, so no
+// pixel is blended twice by the same polygon, and all of them are counter clockwise
+// with y pointing up.
+
+inline
+float Cross(const Vertex &o, const Vertex &a, const Vertex &b) {
+	return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+inline
+float SignedArea(const Vertex *vertices, int count) {
+	float area = 0;
+	for (int i = 0, j = count - 1; i < count; j = i++) {
+		area += vertices[j].x * vertices[i].y - vertices[i].x * vertices[j].y;
+	}
+	return area / 2;
+}
+
+inline
+bool SegmentsCross(const Vertex &a, const Vertex &b, const Vertex &c, const Vertex &d) {
+	float d1 = Cross(c, d, a), d2 = Cross(c, d, b);
+	float d3 = Cross(a, b, c), d4 = Cross(a, b, d);
+	return ((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) &&
+		((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0));
+}
+
+// Whether no two non-adjacent edges of the outline cross.
+inline
+bool IsSimple(const Vertex *vertices, int count) {
+	for (int i = 0; i < count; ++i) {
+		const Vertex &a = vertices[i];
+		const Vertex &b = vertices[(i + 1) % count];
+		for (int j = i + 2; j < count; ++j) {
+			if (i == 0 && j == count - 1)
+				continue;
+			if (SegmentsCross(a, b, vertices[j], vertices[(j + 1) % count]))
+				return false;
+		}
+	}
+	return true;
+}
+
+// Andrew's monotone chain, counter clockwise without collinear points.
+// |hull| holds indices into |vertices|.
+inline
+void ConvexHull(const Vertex *vertices, int count, std::vector<int> *hull) {
+	std::vector<int> points(count);
+	for (int i = 0; i < count; ++i) {
+		points[i] = i;
+	}
+	std::sort(points.begin(), points.end(), [&](int a, int b) {
+		return vertices[a].x < vertices[b].x || (vertices[a].x == vertices[b].x && vertices[a].y < vertices[b].y);
+	});
+
+	hull->assign(2 * count, 0);
+	int k = 0;
+	for (int i = 0; i < count; ++i) {
+		while (k >= 2 && Cross(vertices[(*hull)[k - 2]], vertices[(*hull)[k - 1]], vertices[points[i]]) <= 0)
+			--k;
+		(*hull)[k++] = points[i];
+	}
+	for (int i = count - 2, lower = k + 1; i >= 0; --i) {
+		while (k >= lower && Cross(vertices[(*hull)[k - 2]], vertices[(*hull)[k - 1]], vertices[points[i]]) <= 0)
+			--k;
+		(*hull)[k++] = points[i];
+	}
+	hull->resize(std::max(0, k - 1));
+}
+
+inline
+bool SameVertex(const Vertex &a, const Vertex &b) {
+	return a.x == b.x && a.y == b.y;
+}
+
+inline
+bool InTriangle(const Vertex &p, const Vertex &a, const Vertex &b, const Vertex &c) {
+	return Cross(a, b, p) >= 0 && Cross(b, c, p) >= 0 && Cross(c, a, p) >= 0;
+}
+
+// The remaining outline during ear clipping, as a linked list of positions in the outline.
+// Only non-convex corners can be inside an ear of a simple outline, so those are kept in
+// their own list to check ears against.
+struct EarClipper
+{
+	const Vertex *vertices;
+	const std::vector<int> *outline;
+
+	std::vector<int> prev;
+	std::vector<int> next;
+
+	// Non-convex corners and where each corner is in |reflex|, -1 if it isn't.
+	std::vector<int> reflex;
+	std::vector<int> reflex_position;
+
+	std::vector<char> ear;
+};
+
+inline
+float CornerCross(const EarClipper &clipper, int i) {
+	const std::vector<int> &outline = *clipper.outline;
+	return Cross(clipper.vertices[outline[clipper.prev[i]]], clipper.vertices[outline[i]],
+		clipper.vertices[outline[clipper.next[i]]]);
+}
+
+inline
+void UpdateReflex(EarClipper *clipper, int i, bool reflex) {
+	int &position = clipper->reflex_position[i];
+	if (reflex && position < 0) {
+		position = static_cast<int>(clipper->reflex.size());
+		clipper->reflex.push_back(i);
+	} else if (!reflex && position >= 0) {
+		int last = clipper->reflex.back();
+		clipper->reflex[position] = last;
+		clipper->reflex_position[last] = position;
+		clipper->reflex.pop_back();
+		position = -1;
+	}
+}
+
+// Whether corner |i| can be clipped. Collinear corners always can, without emitting a
+// triangle. Otherwise the corner has to be convex with no non-convex corner inside it.
+inline
+bool IsEar(const EarClipper &clipper, int i) {
+	float cross = CornerCross(clipper, i);
+	if (cross <= 0)
+		return cross == 0;
+
+	const std::vector<int> &outline = *clipper.outline;
+	const Vertex &a = clipper.vertices[outline[clipper.prev[i]]];
+	const Vertex &b = clipper.vertices[outline[i]];
+	const Vertex &c = clipper.vertices[outline[clipper.next[i]]];
+	// Duplicates of the corners at other indices lie on the ear's boundary rather than inside it.
+	for (size_t j = 0; j < clipper.reflex.size(); ++j) {
+		const Vertex &p = clipper.vertices[outline[clipper.reflex[j]]];
+		if (!SameVertex(p, a) && !SameVertex(p, b) && !SameVertex(p, c) && InTriangle(p, a, b, c))
+			return false;
+	}
+	return true;
+}
+
+// Ear clips the simple counter clockwise outline |outline|, given as indices into |vertices|.
+// Clipping a corner only changes whether its two neighbours are reflex or ears, so each clip
+// costs one pass over the reflex corners and the whole outline O(n^2) at worst.
+// Returns false when no ear can be found, which only happens through rounding.
+inline
+bool EarClip(const Vertex *vertices, const std::vector<int> &outline, std::vector<int> *triangles) {
+	int n = static_cast<int>(outline.size());
+	if (n < 3)
+		return true;
+
+	EarClipper clipper;
+	clipper.vertices = vertices;
+	clipper.outline = &outline;
+	clipper.prev.resize(n);
+	clipper.next.resize(n);
+	for (int i = 0; i < n; ++i) {
+		clipper.prev[i] = (i + n - 1) % n;
+		clipper.next[i] = (i + 1) % n;
+	}
+	clipper.reflex_position.assign(n, -1);
+	for (int i = 0; i < n; ++i) {
+		UpdateReflex(&clipper, i, CornerCross(clipper, i) <= 0);
+	}
+	clipper.ear.resize(n);
+	for (int i = 0; i < n; ++i) {
+		clipper.ear[i] = IsEar(clipper, i);
+	}
+
+	// |unclipped| counts the corners passed since the last clip, to stop after a full loop without an ear.
+	int remaining = n;
+	int unclipped = 0;
+	for (int i = 0; remaining > 2; i = clipper.next[i]) {
+		if (!clipper.ear[i]) {
+			if (++unclipped > remaining)
+				return false;
+			continue;
+		}
+		unclipped = 0;
+
+		int a = clipper.prev[i];
+		int c = clipper.next[i];
+		if (CornerCross(clipper, i) > 0) {
+			triangles->push_back(outline[a]);
+			triangles->push_back(outline[i]);
+			triangles->push_back(outline[c]);
+		}
+		UpdateReflex(&clipper, i, false);
+		clipper.next[a] = c;
+		clipper.prev[c] = a;
+		remaining -= 1;
+
+		UpdateReflex(&clipper, a, CornerCross(clipper, a) <= 0);
+		UpdateReflex(&clipper, c, CornerCross(clipper, c) <= 0);
+		if (remaining > 2) {
+			clipper.ear[a] = IsEar(clipper, a);
+			clipper.ear[c] = IsEar(clipper, c);
+		}
+		i = a;
+	}
+	return true;
+}
+
+// Copies the corners of the cached triangles from the vertices and recomputes the area and bounds.
+inline
+void UpdateTriangleCorners(const Poly &polygon) {
+	for (int i = 0; i < polygon.triangle_count * 3; ++i) {
+		CopyVertex(polygon.triangles[i], polygon.vertices[polygon.triangle_vertices[i]]);
+	}
+
+	polygon.area = 0;
+	polygon.min.x = polygon.min.y = 1;
+	polygon.max.x = polygon.max.y = 0;
+	for (int i = 0; i < polygon.triangle_count; ++i) {
+		const Vertex *v = polygon.triangles + i * 3;
+		polygon.area += Cross(v[0], v[1], v[2]) / 2;
+		for (int j = 0; j < 3; ++j) {
+			polygon.min.x = std::min(polygon.min.x, v[j].x);
+			polygon.min.y = std::min(polygon.min.y, v[j].y);
+			polygon.max.x = std::max(polygon.max.x, v[j].x);
+			polygon.max.y = std::max(polygon.max.y, v[j].y);
+		}
+	}
+}
+
+// Fills in the cached triangulation of |polygon| if its geometry changed since it was last computed.
+inline
+void Triangulate(const Poly &polygon) {
+	if (polygon.triangulated)
+		return;
+
+	std::vector<int> triangles;
+	if (polygon.vertex_count >= 3) {
+		std::vector<int> outline(polygon.vertex_count);
+		for (int i = 0; i < polygon.vertex_count; ++i) {
+			outline[i] = i;
+		}
+		if (SignedArea(polygon.vertices, polygon.vertex_count) < 0)
+			std::reverse(outline.begin(), outline.end());
+
+		bool clipped = IsSimple(polygon.vertices, polygon.vertex_count) &&
+			EarClip(polygon.vertices, outline, &triangles);
+		if (!clipped) {
+			triangles.clear();
+
+			std::vector<int> hull;
+			ConvexHull(polygon.vertices, polygon.vertex_count, &hull);
+			for (size_t i = 1; i + 1 < hull.size(); ++i) {
+				triangles.push_back(hull[0]);
+				triangles.push_back(hull[i]);
+				triangles.push_back(hull[i + 1]);
+			}
+		}
+	}
+
+	if (polygon.triangles)
+		delete[] polygon.triangles;
+	if (polygon.triangle_vertices)
+		delete[] polygon.triangle_vertices;
+
+	int corners = static_cast<int>(triangles.size());
+	polygon.triangle_count = corners / 3;
+	polygon.triangles = corners > 0 ? new Vertex[corners] : NULL;
+	polygon.triangle_vertices = corners > 0 ? new int[corners] : NULL;
+	for (int i = 0; i < corners; ++i) {
+		polygon.triangle_vertices[i] = triangles[i];
+	}
+	UpdateTriangleCorners(polygon);
+	polygon.triangulated = true;
+}
+
+// Moves the cached triangles of |polygon| onto its vertices after they moved, but weren't
+// added or removed, without ear clipping it again. Returns false and invalidates the cache
+// if that would flip a triangle. Small moves keep the triangles close to what ear clipping
+// would give, but they aren't guaranteed to match it, so callers triangulate again before
+// rendering with GL.
+inline
+bool MoveTriangulation(Poly &polygon) {
+	if (!polygon.triangle_vertices) {
+		InvalidateTriangulation(polygon);
+		return false;
+	}
+	for (int i = 0; i < polygon.triangle_count; ++i) {
+		const int *corners = polygon.triangle_vertices + i * 3;
+		if (Cross(polygon.vertices[corners[0]], polygon.vertices[corners[1]], polygon.vertices[corners[2]]) <= 0) {
+			InvalidateTriangulation(polygon);
+			return false;
+		}
+	}
+	UpdateTriangleCorners(polygon);
+	polygon.triangulated = true;
+	return true;
+}
+
+#endif
@@ -10,99 +10,44 @@
 #include <GLFW\glfw3.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
+#include <mutex>
 #include <numeric>
 #include <random>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "benchmark_util.hpp"
 #include "image_util.hpp"
+#include "solver.hpp"
 
 using namespace std;
 
-const int kMaxPolygons = 255;
+const int kMaxPreviewSize = 1024;
 
-const float kAddPolygonRate = 1.0f / 700;
-const float kRemovePolygonRate = 1.0f / 1500;
-const float kSwapPolygonRate = 1.0f / 1000;
+const int kDefaultFirstFrameIterations = 20000;
+const int kDefaultFrameIterations = 2000;
 
-const float kAlphaMutationRate = 1.0f / 750;
-const float kAlphaMutationSigma = 0.02f;
-const float kAlphaMin = 30.0f / 255;
-const float kAlphaMax = 60.0f / 255;
+const int kDefaultPolishEvaluations = 2000;
+const int kDefaultLocalSearchEvaluations = 200;
+const int kDefaultGradientSteps = 20;
 
-const float kRedMutationRate = 1.0f / 750;
-const float kRedMutationSigma = 0.1f;
-const float kRedMin = 0.0f;
-const float kRedMax = 1.0f;
+const double kBenchmarkSampleSeconds = 0.1;
+const int kDefaultBenchmarkSeeds = 5;
+const double kDefaultBenchmarkSeconds = 30;
 
-const float kGreenMutationRate = 1.0f / 750;
-const float kGreenMutationSigma = 0.1f;
-const float kGreenMin = 0.0f;
-const float kGreenMax = 1.0f;
+// Significance level for benchmark comparisons against a baseline.
+const double kBenchmarkSignificance = 0.05;
 
-const float kBlueMutationRate = 1.0f / 750;
-const float kBlueMutationSigma = 0.1f;
-const float kBlueMin = 0.0f;
-const float kBlueMax = 1.0f;
-
-const float kVertexMutationRate = 1.0f / 750;
-const float kVertexMutationSigma = 0.1f;
-const float kVertexMin = 0.0f;
-const float kVertexMax = 1.0f;
-
-const float kAddVertexRate = 1.0f / 1000;
-const float kRemoveVertexRate = 1.0f / 1500;
-const float kSwapVertexRate = 1.0f / 1000;
-
-struct Colour
-{
-	float r, g, b, a;
-};
-
-struct Vertex
-{
-	float x, y;
-};
-
-struct Poly
-{
-	Poly() : colour({}), vertex_count(0), vertices(NULL) {}
-
-	~Poly() {
-		if (vertices)
-			delete[] vertices;
-	}
-
-	Colour colour;
-
-	int vertex_count;
-	Vertex *vertices;
-};
-
-struct GeneImage : Image
-{
-	GeneImage() : Image(), polygon_count(0), gene(NULL), fitness(numeric_limits<float>::max()) {}
-
-	~GeneImage() {
-		if (gene)
-			delete[] gene;
-	}
-
-	int polygon_count;
-	Poly *gene;
-
-	float fitness;
-};
-
-struct SimulationState
-{
-	Image source_image;
-	GeneImage gene_image;
-};
+// Compared against when no --baseline is given and the file exists.
+const char kDefaultBenchmarkBaseline[] = "benchmarks/baseline.csv";
 
 void error_callback(int error, const char *description) {
 	fputs(description, stderr);
@@ -126,327 +71,625 @@ void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
 	SimulationState *state = (SimulationState*)glfwGetWindowUserPointer(window);
 }
 
-float BoltzmannProbability(double current_fitness, double new_fitness, float temperature) {
-	return temperature <= 0 ? 0 : exp(-(new_fitness - current_fitness) / temperature);
-}
+void RenderPreview(const GeneImage &gene_image, int width, int height) {
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, width, height);
+	glSetOrthographicProjection(0, gene_image.composite.width, 0, gene_image.composite.height, -1, 1);
 
-double Fitness(const float *buffer1, const float *buffer2, int width, int height, int channels) {
-	float sum = 0;
-	for (int i = 0; i < width * height * channels; ++i) {
-		if (i % 4 != 3) {
-			float diff = (buffer1[i] - buffer2[i]);
-			sum += diff * diff;
-		}
-	}
-	return sum / (width * height * 3.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	Render(gene_image);
 }
 
-int PixelIndex(int x, int y, int width, int channels) {
-	return (y * width + x) * channels;
+struct SequenceOptions
+{
+	string input_dir;
+	string output_dir;
 
-}
+	int first_frame_iterations;
+	int frame_iterations;
 
-void InitRandomVertex(Vertex &vertex, float center_x, float center_y) {
-	vertex.x = center_x + Randf(-0.001f, 0.001f);
-	vertex.y = center_y + Randf(-0.001f, 0.001f);
-	clamp(&vertex.x, kVertexMin, kVertexMax);
-	clamp(&vertex.y, kVertexMin, kVertexMax);
-}
+	// Iterations after which a frame hands its gene to the next frame.
+	int handoff_iterations;
 
-void InitRandomPolygon(SimulationState &state, Poly &polygon, int vertices) {
-	float center_x = Randf(kVertexMin, kVertexMax);
-	float center_y = Randf(kVertexMin, kVertexMax);
+	// Stochastic iterations between local search sweeps, 0 to disable.
+	int local_search_interval;
 
-	int pixel_x = center_x * state.source_image.width;
-	int pixel_y = center_y * state.source_image.height;
+	int polish_evaluations;
+	GeneEncoding encoding;
 
-	int pixel_index = PixelIndex(pixel_x, pixel_y, state.source_image.width, 
-		state.source_image.channels);
-	polygon.colour.r = state.source_image.data[pixel_index + 0];
-	polygon.colour.g = state.source_image.data[pixel_index + 1];
-	polygon.colour.b = state.source_image.data[pixel_index + 2];
-	polygon.colour.a = Randf(kAlphaMin, kAlphaMax);
+	int threads;
+	size_t memory_budget;
+};
 
-	polygon.vertices = new Vertex[vertices];
-	polygon.vertex_count = vertices;
-	for (int i = 0; i < polygon.vertex_count; ++i) {
-		InitRandomVertex(polygon.vertices[i], center_x, center_y);
+// Hands the gene of one frame to the next frame in the sequence.
+struct FrameSeed
+{
+	FrameSeed() : ready(false), polygon_count(0), gene(NULL) {}
+
+	~FrameSeed() {
+		if (gene)
+			delete[] gene;
 	}
-}
 
-void CopyVertex(Vertex &v1, Vertex &v2) {
-	v1.x = v2.x;
-	v1.y = v2.y;
-}
+	mutex lock;
+	condition_variable ready_cv;
+	bool ready;
 
-void CopyVertices(Vertex *v1, Vertex *v2, int num) {
-	for (int i = 0; i < num; ++i) {
-		CopyVertex(v1[i], v2[i]);
-	}
-}
+	int polygon_count;
+	Poly *gene;
+};
 
-void CopyPolygon(Poly &p1, const Poly &p2) {
-	p1.colour.r = p2.colour.r;
-	p1.colour.g = p2.colour.g;
-	p1.colour.b = p2.colour.b;
-	p1.colour.a = p2.colour.a;
+void PublishSeed(FrameSeed *seed, const GeneImage &gene_image) {
+	lock_guard<mutex> guard(seed->lock);
+	if (seed->ready)
+		return;
 
-	if (p1.vertices)
-		delete[] p1.vertices;
+	seed->polygon_count = gene_image.polygon_count;
+	seed->gene = new Poly[seed->polygon_count];
+	CopyPolygons(seed->gene, gene_image.gene, seed->polygon_count);
 
-	p1.vertex_count = p2.vertex_count;
-	p1.vertices = p2.vertices ? new Vertex[p2.vertex_count] : NULL;
+	seed->ready = true;
+	seed->ready_cv.notify_all();
+}
+
+void WaitForSeed(FrameSeed *seed, GeneImage *gene_image) {
+	unique_lock<mutex> guard(seed->lock);
+	seed->ready_cv.wait(guard, [seed] { return seed->ready; });
 
-	CopyVertices(p1.vertices, p2.vertices, p2.vertex_count);
+	AssignGene(gene_image, seed->gene, seed->polygon_count);
+	RebuildPolygonIndex(gene_image);
+	gene_image->composite_valid = false;
 }
 
-void CopyPolygons(Poly *p1, Poly *p2, int num) {
-	for (int i = 0; i < num; ++i) {
-		CopyPolygon(p1[i], p2[i]);
+// Hands the previous frame's gene on in place of a frame which failed,
+// so later frames still warm start from the last good gene.
+void ForwardSeed(FrameSeed *prev_seed, FrameSeed *seed) {
+	GeneImage gene_image;
+	if (prev_seed) {
+		unique_lock<mutex> guard(prev_seed->lock);
+		prev_seed->ready_cv.wait(guard, [prev_seed] { return prev_seed->ready; });
+
+		AssignGene(&gene_image, prev_seed->gene, prev_seed->polygon_count);
 	}
+	PublishSeed(seed, gene_image);
 }
 
-void CalculateCentroid(Poly &polygon, float &x, float &y) {
-	x = 0;
-	y = 0;
-	for (int i = 0; i < polygon.vertex_count; ++i) {
-		x += polygon.vertices[i].x;
-		y += polygon.vertices[i].y;
+bool ListFrames(const string &dir, vector<string> *frames) {
+	WIN32_FIND_DATA find_data;
+	HANDLE find = FindFirstFile((dir + "\\*.png").c_str(), &find_data);
+	if (find == INVALID_HANDLE_VALUE) {
+		LOG("No frames in %s\n", dir.c_str());
+		return false;
 	}
-	x /= polygon.vertex_count;
-	y /= polygon.vertex_count;
-}
 
-void AddVertex(Poly &polygon, int num) {
-	Vertex *prev_vertices = polygon.vertices;
-	polygon.vertices = new Vertex[polygon.vertex_count + num];
+	do {
+		if (!(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			frames->push_back(find_data.cFileName);
+	} while (FindNextFile(find, &find_data));
+	FindClose(find);
 
-	CopyVertices(polygon.vertices, prev_vertices, polygon.vertex_count);
+	sort(frames->begin(), frames->end());
+	return true;
+}
 
-	float center_x, center_y;
-	CalculateCentroid(polygon, center_x, center_y);
-	for (int i = 0; i < num; ++i) {
-		InitRandomVertex(polygon.vertices[polygon.vertex_count + i], center_x, center_y);
+bool RunFrame(const SequenceOptions &options, const string &frame, GLuint framebuffer,
+	          GLuint colour_buffer, FrameSeed *prev_seed, FrameSeed *seed) {
+	SimulationState state;
+	SeedState(state, rand());
+	state.encoding = options.encoding;
+	state.tile_framebuffer = framebuffer;
+	state.tile_colour_buffer = colour_buffer;
+
+	if (!LoadPNGTiled(options.input_dir + "\\" + frame, &state.source_image, options.memory_budget)) {
+		LOG("Failed to load %s\n", frame.c_str());
+		ForwardSeed(prev_seed, seed);
+		return false;
 	}
 
-	polygon.vertex_count += num;
+	int iterations = options.frame_iterations;
+	float temperature = 0.0f;
+	if (prev_seed) {
+		if (!InitGeneImage(state, state.source_image, 0, 0, options.memory_budget, &state.gene_image)) {
+			ForwardSeed(prev_seed, seed);
+			return false;
+		}
+		WaitForSeed(prev_seed, &state.gene_image);
+	} else {
+		if (!InitGeneImage(state, state.source_image, 3, 8, options.memory_budget, &state.gene_image)) {
+			ForwardSeed(prev_seed, seed);
+			return false;
+		}
+		iterations = options.first_frame_iterations;
+		temperature = 1.0f;
+	}
+	SyncComposite(state);
 
-	delete[] prev_vertices;
-}
+	for (int i = 0; i < iterations && !TilesFailed(state); ++i) {
+		if (i == options.handoff_iterations)
+			PublishSeed(seed, state.gene_image);
 
-void RemoveVertex(Poly &polygon, int num) {
-	// TODO(orglofch): fix for num
-	Vertex *prev_vertices = polygon.vertices;
-	polygon.vertices = new Vertex[polygon.vertex_count - 1];
+		UpdateAndRender(state, temperature, 0);
+		temperature -= 0.001f;
 
-	int index = rand() % polygon.vertex_count;
-	CopyVertices(polygon.vertices, prev_vertices, index);
-	CopyVertices(polygon.vertices + index, prev_vertices + index + 1,
-		polygon.vertex_count - index - 1);
+		if (options.local_search_interval > 0 && (i + 1) % options.local_search_interval == 0)
+			LocalSearch(state, kDefaultLocalSearchEvaluations);
+	}
+	if (TilesFailed(state)) {
+		LOG("Failed to map tiles for %s\n", frame.c_str());
+		ForwardSeed(prev_seed, seed);
+		return false;
+	}
+	PublishSeed(seed, state.gene_image);
 
-	polygon.vertex_count -= 1;
+	Polish(state, options.polish_evaluations);
 
-	delete[] prev_vertices;
+	string name = frame.substr(0, frame.find_last_of('.'));
+	return SaveGene(options.output_dir + "\\" + name + ".vgz", state.gene_image, state.encoding);
 }
 
-void SwapVertex(Poly &polygon) {
-	int i1 = rand() % polygon.vertex_count;
-	int i2 = rand() % polygon.vertex_count;
+// Each worker owns a hidden window for its context and processes every
+// |threads|th frame. A frame waits for the previous frame to reach
+// |handoff_iterations| before warm starting from its gene.
+void SequenceWorker(const SequenceOptions &options, const vector<string> &frames,
+	                GLFWwindow *context, int worker, FrameSeed *seeds, atomic<int> *failed_frames) {
+	srand(time(NULL) + worker);
+
+	glfwMakeContextCurrent(context);
+	InitGLState();
+
+	GLuint framebuffer, colour_buffer;
+	bool created = glCreateFramebuffer(&framebuffer, &colour_buffer, kTileSize, kTileSize);
+	if (!created)
+		LOG("Failed to create a framebuffer for worker %d\n", worker);
+
+	for (size_t i = worker; i < frames.size(); i += options.threads) {
+		FrameSeed *prev_seed = i > 0 ? &seeds[i - 1] : NULL;
+		if (!created) {
+			ForwardSeed(prev_seed, &seeds[i]);
+			*failed_frames += 1;
+			continue;
+		}
+		if (!RunFrame(options, frames[i], framebuffer, colour_buffer, prev_seed, &seeds[i])) {
+			LOG("Failed frame %s\n", frames[i].c_str());
+			*failed_frames += 1;
+		}
+	}
 
-	Vertex temp;
-	CopyVertex(temp, polygon.vertices[i1]);
-	CopyVertex(polygon.vertices[i1], polygon.vertices[i2]);
-	CopyVertex(polygon.vertices[i2], temp);
+	if (created) {
+		glDeleteRenderbuffers(1, &colour_buffer);
+		glDeleteFramebuffers(1, &framebuffer);
+	}
+	glfwMakeContextCurrent(NULL);
 }
 
-void AddPolygon(SimulationState &state, GeneImage *gene_image, int num) {
-	Poly *prev_gene = gene_image->gene;
-	gene_image->gene = new Poly[gene_image->polygon_count + num];
+bool RunSequence(const SequenceOptions &options) {
+	vector<string> frames;
+	if (!ListFrames(options.input_dir, &frames))
+		return false;
+
+	CreateDirectory(options.output_dir.c_str(), NULL);
+
+	// GLEW is initialized on every context, one at a time, before any worker starts.
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	vector<GLFWwindow*> contexts;
+	bool initialized = true;
+	for (int i = 0; i < options.threads && initialized; ++i) {
+		GLFWwindow *context = glfwCreateWindow(1, 1, "Vectorize", NULL, NULL);
+		if (!context) {
+			LOG("Failed to create window\n");
+			initialized = false;
+			break;
+		}
+		contexts.push_back(context);
 
-	CopyPolygons(gene_image->gene, prev_gene, gene_image->polygon_count);
+		glfwMakeContextCurrent(context);
+		if (glewInit() != GLEW_OK) {
+			LOG("Failed to initialize glew\n");
+			initialized = false;
+		}
+		glfwMakeContextCurrent(NULL);
+	}
+	if (!initialized) {
+		for (size_t i = 0; i < contexts.size(); ++i) {
+			glfwDestroyWindow(contexts[i]);
+		}
+		return false;
+	}
+
+	FrameSeed *seeds = new FrameSeed[frames.size()];
+	atomic<int> failed_frames(0);
 
-	for (int i = 0; i < num; ++i) {
-		InitRandomPolygon(state, gene_image->gene[gene_image->polygon_count + i], 8);
+	double start = glfwGetTime();
+	vector<thread> workers;
+	for (int i = 0; i < options.threads; ++i) {
+		workers.push_back(thread(SequenceWorker, cref(options), cref(frames), contexts[i], i, seeds,
+			&failed_frames));
 	}
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+	double elapsed = glfwGetTime() - start;
 
-	gene_image->polygon_count += num;
+	printf("%d frames in %.1fs (%.2f frames/minute)\n", static_cast<int>(frames.size()),
+		elapsed, frames.size() * 60.0 / elapsed);
+	if (failed_frames > 0)
+		fprintf(stderr, "%d of %d frames failed\n", failed_frames.load(), static_cast<int>(frames.size()));
 
-	delete[] prev_gene;
+	delete[] seeds;
+	for (size_t i = 0; i < contexts.size(); ++i) {
+		glfwDestroyWindow(contexts[i]);
+	}
+	return failed_frames == 0;
 }
 
-void RemovePolygon(GeneImage *gene_image, int num) {
-	// TODO(orglofch): fix for num
-	Poly *prev_gene = gene_image->gene;
-	gene_image->gene = new Poly[gene_image->polygon_count - 1];
+struct BenchmarkOptions
+{
+	vector<string> images;
+	int seeds;
+	double seconds;
 
-	int index = rand() % gene_image->polygon_count;
-	CopyPolygons(gene_image->gene, prev_gene, index);
-	CopyPolygons(gene_image->gene + index, prev_gene + index + 1, 
-		         gene_image->polygon_count - index - 1);
+	// Fitness for time-to-target, the baseline's median final fitness when 0.
+	double target_fitness;
 
-	gene_image->polygon_count -= 1;
+	string baseline_file;
+	string traces_file;
 
-	delete[] prev_gene;
-}
+	int pipeline_workers;
+	size_t memory_budget;
 
-void SwapPolygon(GeneImage *gene_image) {
-	int i1 = rand() % gene_image->polygon_count;
-	int i2 = rand() % gene_image->polygon_count;
+	// Iterations between gradient refinements, 0 to disable, see GradientRefine().
+	int gradient_interval;
+	int gradient_steps;
+	int gradient_threads;
+};
 
-	Poly temp;
-	CopyPolygon(temp, gene_image->gene[i1]);
-	CopyPolygon(gene_image->gene[i1], gene_image->gene[i2]);
-	CopyPolygon(gene_image->gene[i2], temp);
-}
+// Runs the optimizer headless on |image| for the time budget, sampling the fitness as it goes.
+bool RunBenchmarkImage(const BenchmarkOptions &options, const string &image, unsigned int seed,
+	                   GLuint framebuffer, GLuint colour_buffer, BenchmarkRun *run) {
+	SimulationState state;
+	SeedState(state, seed);
+	state.tile_framebuffer = framebuffer;
+	state.tile_colour_buffer = colour_buffer;
+
+	if (!LoadPNGTiled(image, &state.source_image, options.memory_budget) ||
+		!InitGeneImage(state, state.source_image, 3, 8, options.memory_budget, &state.gene_image)) {
+		LOG("Failed to load %s\n", image.c_str());
+		return false;
+	}
 
-bool ShouldMutate(float rate) {
-	float prob = Randf(0, 1);
-	return prob <= rate;
-}
+	run->image = image;
+	run->seed = seed;
 
-void MutatePolygon(Poly &polygon, double sigma_modifier, double rate_modifier) {
-	if (polygon.vertex_count > 3 && ShouldMutate(kRemoveVertexRate)) {
-		RemoveVertex(polygon, 1);
-	} else if (polygon.vertex_count < kMaxPolygons && ShouldMutate(kAddVertexRate)) {
-		AddVertex(polygon, 1);
-	} else if (polygon.vertex_count > 1 && ShouldMutate(kSwapVertexRate)) {
-		SwapVertex(polygon);
-	} else {
-		LARGE_INTEGER t;
-		QueryPerformanceCounter(&t);
-		default_random_engine generator(t.QuadPart);
-		normal_distribution<float> red_dist(0, kRedMutationSigma * sigma_modifier);
-		if (ShouldMutate(kRedMutationRate * rate_modifier)) {
-			float value = red_dist(generator);
-			polygon.colour.r += value;
-			clamp(&polygon.colour.r, kRedMin, kRedMax);
-		}
-		normal_distribution<float> green_dist(0, kGreenMutationSigma * sigma_modifier);
-		if (ShouldMutate(kGreenMutationRate * rate_modifier)) {
-			float value = green_dist(generator);
-			polygon.colour.g += value;
-			clamp(&polygon.colour.g, kGreenMin, kGreenMax);
-		}
-		normal_distribution<float> blue_dist(0, kBlueMutationSigma * sigma_modifier);
-		if (ShouldMutate(kBlueMutationRate * rate_modifier)) {
-			float value = blue_dist(generator);
-			polygon.colour.b += value;
-			clamp(&polygon.colour.b, kBlueMin, kBlueMax);
+	// Score the initial gene up front so the first sample isn't FLT_MAX.
+	SyncComposite(state);
+	if (TilesFailed(state)) {
+		LOG("Failed to map tiles for %s\n", image.c_str());
+		return false;
+	}
+
+	Pipeline pipeline;
+	if (options.pipeline_workers > 0)
+		StartPipeline(&pipeline, state, options.pipeline_workers);
+
+	float temperature = 1.0f;
+	double start = glfwGetTime();
+	double next_sample = 0;
+	int iteration = 0;
+	while (true) {
+		double elapsed = glfwGetTime() - start;
+		if (elapsed >= next_sample || elapsed >= options.seconds) {
+			BenchmarkSample sample;
+			sample.seconds = elapsed;
+			sample.iterations = options.pipeline_workers > 0 ? pipeline.total_scored : state.iterations;
+			sample.fitness = state.gene_image.fitness;
+			run->samples.push_back(sample);
+			next_sample += kBenchmarkSampleSeconds;
 		}
-		normal_distribution<float> alpha_dist(0, kAlphaMutationSigma * sigma_modifier);
-		if (ShouldMutate(kAlphaMutationRate * rate_modifier)) {
-			float value = alpha_dist(generator);
-			polygon.colour.a += value;
-			clamp(&polygon.colour.a, kAlphaMin, kAlphaMax);
+		if (elapsed >= options.seconds || TilesFailed(state))
+			break;
+
+		if (options.pipeline_workers > 0) {
+			PipelineStep(&pipeline, state, temperature);
+			temperature = 1.0f - 0.001f * pipeline.total_scored;
+		} else {
+			UpdateAndRender(state, temperature, 0);
+			temperature -= 0.001f;
 		}
-		normal_distribution<float> vertex_dist(0, kVertexMutationSigma * sigma_modifier);
-		for (int i = 0; i < polygon.vertex_count; ++i) {
-			Vertex &vertex = polygon.vertices[i];
-			if (ShouldMutate(kVertexMutationRate * rate_modifier)) {
-				float value = vertex_dist(generator);
-				vertex.x += value;
-				clamp(&vertex.x, kVertexMin, kVertexMax);
-			}
-			if (ShouldMutate(kVertexMutationRate * rate_modifier)) {
-				float value = vertex_dist(generator);
-				vertex.y += value;
-				clamp(&vertex.y, kVertexMin, kVertexMax);
-			}
+
+		iteration += 1;
+		if (options.gradient_interval > 0 && iteration % options.gradient_interval == 0) {
+			StopPipeline(&pipeline);
+			GradientRefine(state, options.gradient_steps, options.gradient_threads, start + options.seconds, NULL);
+			if (options.pipeline_workers > 0)
+				StartPipeline(&pipeline, state, options.pipeline_workers);
 		}
 	}
-}
+	StopPipeline(&pipeline);
 
-void Mutate(SimulationState &state) {
-	if (state.gene_image.polygon_count > 1 && ShouldMutate(kRemovePolygonRate)) {
-		RemovePolygon(&state.gene_image, 1);
-	} else if (state.gene_image.polygon_count < kMaxPolygons && ShouldMutate(kAddPolygonRate)) {
-		AddPolygon(state, &state.gene_image, 1);
-	} else if (state.gene_image.polygon_count > 1 && ShouldMutate(kSwapPolygonRate)) {
-		SwapPolygon(&state.gene_image);
-	} else {
-		for (int i = 0; i < state.gene_image.polygon_count; ++i) {
-			MutatePolygon(state.gene_image.gene[i], 
-				1.0 - state.gene_image.fitness,
-				1.0 - state.gene_image.fitness);
-		}
+	if (TilesFailed(state)) {
+		LOG("Failed to map tiles for %s\n", image.c_str());
+		return false;
 	}
+	return true;
 }
 
-void RenderPolygon(const Poly &polygon, int width, int height) {
-	glColor4f(polygon.colour.r, polygon.colour.g, polygon.colour.b, polygon.colour.a);
-	glBegin(GL_TRIANGLE_STRIP);
-		for (int i = 0; i < polygon.vertex_count; ++i) {
-			Vertex &vertex = polygon.vertices[i];
-			glVertex2f(vertex.x * width, vertex.y * height);
-		}
-	glEnd();
+// Prints the mean of |current| against |baseline| and returns whether
+// |current| is significantly higher, lower being better.
+bool CompareMetric(const char *name, const vector<double> &current, const vector<double> &baseline) {
+	double p = WelchTTest(current, baseline);
+	double current_mean = Mean(current);
+	double baseline_mean = Mean(baseline);
+
+	const char *verdict = "no significant change";
+	if (p < kBenchmarkSignificance)
+		verdict = current_mean < baseline_mean ? "improved" : "REGRESSED";
+
+	printf("  %-16s %12.6g vs %12.6g (%+.2f%%), p = %.4f, %s\n", name, current_mean, baseline_mean,
+		baseline_mean != 0 ? 100.0 * (current_mean - baseline_mean) / baseline_mean : 0.0, p, verdict);
+	return p < kBenchmarkSignificance && current_mean > baseline_mean;
 }
 
-void Render(const GeneImage &gene_image) {
-	for (int i = 0; i < gene_image.polygon_count; ++i) {
-		RenderPolygon(gene_image.gene[i], gene_image.width, gene_image.height);
+// Collects a summary metric of every run on |image| at the benchmark's time budget.
+// Runs which never reach |target| count as taking the whole budget.
+void CollectMetrics(const vector<BenchmarkRun> &runs, const string &image, double seconds,
+	                double target, vector<double> *final_fitness, vector<double> *time_to_target,
+	                vector<double> *iteration_rate) {
+	for (size_t i = 0; i < runs.size(); ++i) {
+		if (runs[i].image != image)
+			continue;
+
+		BenchmarkSample sample = SampleAt(runs[i].samples, seconds);
+		final_fitness->push_back(sample.fitness);
+		iteration_rate->push_back(sample.seconds > 0 ? sample.iterations / sample.seconds : 0);
+
+		double time = TimeToTarget(runs[i].samples, target);
+		time_to_target->push_back(time < 0 || time > seconds ? seconds : time);
 	}
 }
 
-void ReadBuffer(float *buffer, int width, int height, int channels) {
-	glReadPixels(0, 0, width, height, channels == 4 ? GL_RGBA : GL_RGB, GL_FLOAT, buffer);
-}
+// Runs every image with every seed and compares the results against the
+// baseline traces. Returns false when a run fails or a metric regressed.
+bool RunBenchmark(const BenchmarkOptions &options) {
+	vector<BenchmarkRun> baseline;
+	if (!options.baseline_file.empty() && !LoadBenchmarkTraces(options.baseline_file, &baseline)) {
+		LOG("Failed to load baseline %s\n", options.baseline_file.c_str());
+		return false;
+	}
 
-void UpdateAndRender(SimulationState &state, float temperature, float dt) {
-	Poly *copy_gene = new Poly[state.gene_image.polygon_count];
-	int old_polygon_count = state.gene_image.polygon_count;
-	
-	CopyPolygons(copy_gene, state.gene_image.gene, state.gene_image.polygon_count);
-	
-	Mutate(state);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow *context = glfwCreateWindow(1, 1, "Vectorize", NULL, NULL);
+	if (!context) {
+		LOG("Failed to create window\n");
+		return false;
+	}
+	glfwMakeContextCurrent(context);
+	if (glewInit() != GLEW_OK) {
+		LOG("Failed to initialize glew\n");
+		glfwDestroyWindow(context);
+		return false;
+	}
+	InitGLState();
 
-	glClear(GL_COLOR_BUFFER_BIT);
-	Render(state.gene_image);
-	ReadBuffer(state.gene_image.data, state.gene_image.width, 
-		state.gene_image.height, state.gene_image.channels);
+	GLuint framebuffer, colour_buffer;
+	if (!glCreateFramebuffer(&framebuffer, &colour_buffer, kTileSize, kTileSize)) {
+		glfwDestroyWindow(context);
+		return false;
+	}
 
-	double new_fitness = Fitness(state.source_image.data, state.gene_image.data,
-		state.gene_image.width, state.gene_image.height, state.gene_image.channels);
-	if (new_fitness < state.gene_image.fitness ||
-		Randf(0, 1) < BoltzmannProbability(state.gene_image.fitness, new_fitness, temperature)) {
-		delete[] copy_gene;
+	bool success = true;
+	vector<BenchmarkRun> runs;
+	for (size_t i = 0; i < options.images.size(); ++i) {
+		for (int seed = 1; seed <= options.seeds; ++seed) {
+			BenchmarkRun run;
+			if (!RunBenchmarkImage(options, options.images[i], seed, framebuffer, colour_buffer, &run)) {
+				success = false;
+				continue;
+			}
+			const BenchmarkSample &last = run.samples.back();
+			printf("%s seed %d: fitness %.6f after %lld iterations in %.1fs\n", run.image.c_str(),
+				seed, last.fitness, last.iterations, last.seconds);
+			runs.push_back(run);
+		}
+	}
 
-		state.gene_image.fitness = new_fitness;
-	} else {
-		state.gene_image.polygon_count = old_polygon_count;
+	if (!options.traces_file.empty())
+		SaveBenchmarkTraces(options.traces_file, runs);
 
-		delete[] state.gene_image.gene;
-		state.gene_image.gene = copy_gene;
-	}
-}
+	for (size_t i = 0; i < options.images.size(); ++i) {
+		const string &image = options.images[i];
 
-void InitGeneImage(SimulationState &state, Image *image, int polygons, int vertices, GeneImage *gene_image) {
-	gene_image->width = image->width;
-	gene_image->height = image->height;
-	gene_image->channels = image->channels;
+		vector<double> baseline_final;
+		for (size_t j = 0; j < baseline.size(); ++j) {
+			if (baseline[j].image == image)
+				baseline_final.push_back(SampleAt(baseline[j].samples, options.seconds).fitness);
+		}
+		double target = options.target_fitness;
+		if (target <= 0)
+			target = Median(baseline_final);
+
+		vector<double> final_fitness, time_to_target, iteration_rate;
+		CollectMetrics(runs, image, options.seconds, target, &final_fitness, &time_to_target, &iteration_rate);
+
+		// Without a target every run takes the full time, so there's no time to report.
+		printf("%s: final fitness at %.0fs %.6f", image.c_str(), options.seconds, Mean(final_fitness));
+		if (target > 0)
+			printf(", median time to %.6f %.2fs", target, Median(time_to_target));
+		printf(", %.0f iterations/s\n", Mean(iteration_rate));
+
+		// Without baseline runs nothing is compared, which mustn't pass silently.
+		if (baseline_final.empty()) {
+			fprintf(stderr, "  NO BASELINE: %s has no runs in %s, nothing was compared. Save --traces and "
+				"copy them over %s to record one.\n", image.c_str(),
+				options.baseline_file.empty() ? "any baseline" : options.baseline_file.c_str(),
+				kDefaultBenchmarkBaseline);
+			success = false;
+			continue;
+		}
 
-	gene_image->data = new float[gene_image->width * gene_image->height * gene_image->channels];
+		vector<double> baseline_fitness, baseline_time, baseline_rate;
+		CollectMetrics(baseline, image, options.seconds, target, &baseline_fitness, &baseline_time, &baseline_rate);
 
-	gene_image->polygon_count = polygons;
-	gene_image->gene = new Poly[gene_image->polygon_count];
-	for (int i = 0; i < polygons; ++i) {
-		Poly &polygon = gene_image->gene[i];
-		InitRandomPolygon(state, polygon, vertices);
+		// Iteration rate alone isn't a regression, only converging slower is.
+		success &= !CompareMetric("final fitness", final_fitness, baseline_fitness);
+		success &= !CompareMetric("time to target", time_to_target, baseline_time);
+		printf("  %-16s %12.0f vs %12.0f\n", "iterations/s", Mean(iteration_rate), Mean(baseline_rate));
 	}
+
+	glDeleteRenderbuffers(1, &colour_buffer);
+	glDeleteFramebuffers(1, &framebuffer);
+	glfwDestroyWindow(context);
+	return success;
 }
 
 int main(int argc, char **argv) {
-	srand(time(NULL));
+	unsigned int seed = static_cast<unsigned int>(time(NULL));
 
 	string input_file = "girl_with_a_pearl_earring.png";
+	size_t memory_budget = kDefaultMemoryBudget;
+
+	bool benchmark = false;
+	BenchmarkOptions benchmark_options;
+	benchmark_options.seeds = kDefaultBenchmarkSeeds;
+	benchmark_options.seconds = kDefaultBenchmarkSeconds;
+	benchmark_options.target_fitness = 0;
+
+	SequenceOptions sequence_options;
+	sequence_options.output_dir = "genes";
+	sequence_options.first_frame_iterations = kDefaultFirstFrameIterations;
+	sequence_options.frame_iterations = kDefaultFrameIterations;
+	sequence_options.handoff_iterations = -1;
+	sequence_options.threads = 1;
+
+	int polish_evaluations = kDefaultPolishEvaluations;
+	int local_search_interval = 0;
+	int gradient_interval = 0;
+	int gradient_steps = kDefaultGradientSteps;
+	int gradient_threads = max(1u, thread::hardware_concurrency());
+	int pipeline_workers = 0;
+	GeneEncoding encoding;
+
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--memory-budget" && i + 1 < argc) {
+			int megabytes = atoi(argv[++i]);
+			if (megabytes <= 0) {
+				fprintf(stderr, "--memory-budget must be a positive number of MB\n");
+				exit(EXIT_FAILURE);
+			}
+			memory_budget = megabytes;
+		} else if (arg == "--sequence" && i + 1 < argc) {
+			sequence_options.input_dir = argv[++i];
+		} else if (arg == "--output" && i + 1 < argc) {
+			sequence_options.output_dir = argv[++i];
+		} else if (arg == "--first-frame-iterations" && i + 1 < argc) {
+			sequence_options.first_frame_iterations = atoi(argv[++i]);
+		} else if (arg == "--frame-iterations" && i + 1 < argc) {
+			sequence_options.frame_iterations = atoi(argv[++i]);
+		} else if (arg == "--handoff-iterations" && i + 1 < argc) {
+			sequence_options.handoff_iterations = atoi(argv[++i]);
+		} else if (arg == "--polish-evaluations" && i + 1 < argc) {
+			polish_evaluations = atoi(argv[++i]);
+		} else if (arg == "--local-search-interval" && i + 1 < argc) {
+			local_search_interval = atoi(argv[++i]);
+		} else if (arg == "--gradient-interval" && i + 1 < argc) {
+			gradient_interval = atoi(argv[++i]);
+		} else if (arg == "--gradient-steps" && i + 1 < argc) {
+			gradient_steps = atoi(argv[++i]);
+		} else if (arg == "--pipeline" && i + 1 < argc) {
+			pipeline_workers = max(0, atoi(argv[++i]));
+		} else if (arg == "--vertex-bits" && i + 1 < argc) {
+			encoding.vertex_bits = atoi(argv[++i]);
+			clamp(&encoding.vertex_bits, kMinVertexBits, kMaxVertexBits);
+		} else if (arg == "--delta") {
+			encoding.delta = true;
+		} else if (arg == "--threads" && i + 1 < argc) {
+			sequence_options.threads = max(1, atoi(argv[++i]));
+		} else if (arg == "--seed" && i + 1 < argc) {
+			seed = static_cast<unsigned int>(strtoul(argv[++i], NULL, 10));
+		} else if (arg == "--benchmark") {
+			benchmark = true;
+		} else if (arg == "--seeds" && i + 1 < argc) {
+			benchmark_options.seeds = max(1, atoi(argv[++i]));
+		} else if (arg == "--benchmark-seconds" && i + 1 < argc) {
+			benchmark_options.seconds = atof(argv[++i]);
+		} else if (arg == "--target-fitness" && i + 1 < argc) {
+			benchmark_options.target_fitness = atof(argv[++i]);
+		} else if (arg == "--baseline" && i + 1 < argc) {
+			benchmark_options.baseline_file = argv[++i];
+		} else if (arg == "--traces" && i + 1 < argc) {
+			benchmark_options.traces_file = argv[++i];
+		} else {
+			input_file = arg;
+			benchmark_options.images.push_back(arg);
+		}
+	}
+	srand(seed);
+	// The budget is given in MB and split evenly between the source and composite.
+	memory_budget = memory_budget * 1024 * 1024 / 2;
+
+	if (!sequence_options.input_dir.empty()) {
+		// Without pipelining each frame starts from the fully converged previous frame.
+		if (sequence_options.handoff_iterations < 0) {
+			sequence_options.handoff_iterations = sequence_options.threads > 1 ?
+				sequence_options.frame_iterations / 2 : numeric_limits<int>::max();
+		}
+		sequence_options.memory_budget = memory_budget / sequence_options.threads;
+		sequence_options.polish_evaluations = polish_evaluations;
+		sequence_options.local_search_interval = local_search_interval;
+		sequence_options.encoding = encoding;
+
+		if (!glfwInit()) {
+			LOG("Failed to initialize glfw\n");
+			exit(EXIT_FAILURE);
+		}
+		glfwSetErrorCallback(error_callback);
+
+		bool success = RunSequence(sequence_options);
+
+		glfwTerminate();
+		exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	if (benchmark) {
+		if (benchmark_options.images.empty())
+			benchmark_options.images.push_back("images/example.png");
+		if (benchmark_options.baseline_file.empty()) {
+			FILE *baseline = fopen(kDefaultBenchmarkBaseline, "r");
+			if (baseline) {
+				fclose(baseline);
+				benchmark_options.baseline_file = kDefaultBenchmarkBaseline;
+			}
+		}
+		benchmark_options.pipeline_workers = pipeline_workers;
+		benchmark_options.memory_budget = memory_budget;
+		benchmark_options.gradient_interval = gradient_interval;
+		benchmark_options.gradient_steps = gradient_steps;
+		benchmark_options.gradient_threads = gradient_threads;
+
+		if (!glfwInit()) {
+			LOG("Failed to initialize glfw\n");
+			exit(EXIT_FAILURE);
+		}
+		glfwSetErrorCallback(error_callback);
+
+		bool success = RunBenchmark(benchmark_options);
+
+		glfwTerminate();
+		exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
 
 	SimulationState state;
+	SeedState(state, seed);
+	state.encoding = encoding;
 
-	if (!LoadPNG(input_file, &state.source_image)) {
+	if (!LoadPNGTiled(input_file, &state.source_image, memory_budget)) {
 		LOG("Failed to load %s\n", input_file.c_str());
 		exit(EXIT_FAILURE);
 	}
-	InitGeneImage(state, &state.source_image, 3, 8, &state.gene_image);
+	if (!InitGeneImage(state, state.source_image, 3, 8, memory_budget, &state.gene_image)) {
+		LOG("Failed to create composite for %s\n", input_file.c_str());
+		exit(EXIT_FAILURE);
+	}
 
 	GLFWwindow *window;
 	if (!glfwInit()) {
@@ -456,8 +699,10 @@ int main(int argc, char **argv) {
 
 	glfwSetErrorCallback(error_callback);
 
-	window = glfwCreateWindow(state.source_image.width, 
-		state.source_image.height, "Vectorize", NULL, NULL);
+	float preview_scale = min(1.0f, static_cast<float>(kMaxPreviewSize) /
+		max(state.source_image.width, state.source_image.height));
+	window = glfwCreateWindow(state.source_image.width * preview_scale,
+		state.source_image.height * preview_scale, "Vectorize", NULL, NULL);
 	if (!window) {
 		LOG("Failed to create window\n");
 		glfwTerminate();
@@ -478,35 +723,50 @@ int main(int argc, char **argv) {
 		exit(EXIT_FAILURE);
 	}
 
-	glViewport(0, 0, state.source_image.width, state.source_image.height);
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-
-	gluOrtho2D(0, state.source_image.width, 0, state.source_image.height);
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-
-	glEnable(GL_POLYGON_SMOOTH);
-	glEnable(GL_MULTISAMPLE);
-	glShadeModel(GL_SMOOTH);
+	const TiledImage &composite = state.gene_image.composite;
+	if (!glCreateFramebuffer(&state.tile_framebuffer, &state.tile_colour_buffer,
+		min(composite.tile_size, composite.width), min(composite.tile_size, composite.height))) {
+		glfwTerminate();
+		exit(EXIT_FAILURE);
+	}
 
-	glEnable(GL_NORMALIZE);
-	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_FRONT);
-	glDisable(GL_LIGHTING);
+	InitGLState();
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	Pipeline pipeline;
+	if (pipeline_workers > 0)
+		StartPipeline(&pipeline, state, pipeline_workers);
 
 	float temperature = 1.0f;
 	double time = glfwGetTime();
-	while (!glfwWindowShouldClose(window)) {
+	int iteration = 0;
+	while (!glfwWindowShouldClose(window) && !TilesFailed(state)) {
 		glfwPollEvents();
 
-		UpdateAndRender(state, temperature, glfwGetTime() - time);
+		if (pipeline_workers > 0) {
+			do {
+				PipelineStep(&pipeline, state, temperature);
+			} while (glfwGetTime() - time < 1.0f / 60);
+		} else {
+			UpdateAndRender(state, temperature, glfwGetTime() - time);
+		}
+
+		iteration += 1;
+		if (local_search_interval > 0 && iteration % local_search_interval == 0) {
+			StopPipeline(&pipeline);
+			LocalSearch(state, kDefaultLocalSearchEvaluations);
+			if (pipeline_workers > 0)
+				StartPipeline(&pipeline, state, pipeline_workers);
+		}
+		if (gradient_interval > 0 && iteration % gradient_interval == 0) {
+			StopPipeline(&pipeline);
+			GradientRefine(state, gradient_steps, gradient_threads, 0, NULL);
+			if (pipeline_workers > 0)
+				StartPipeline(&pipeline, state, pipeline_workers);
+		}
+
+		int preview_width, preview_height;
+		glfwGetFramebufferSize(window, &preview_width, &preview_height);
+		RenderPreview(state.gene_image, preview_width, preview_height);
 
 		glfwSwapBuffers(window);
 
@@ -515,8 +775,22 @@ int main(int argc, char **argv) {
 		temperature -= 0.001f;
 	}
 
+	StopPipeline(&pipeline);
+
+	// A gene scored against tiles which couldn't be mapped isn't worth saving.
+	if (!TilesFailed(state))
+		Polish(state, polish_evaluations);
+	string output_file = input_file.substr(0, input_file.find_last_of('.')) + ".vgz";
+	bool saved = !TilesFailed(state) && SaveGene(output_file, state.gene_image, encoding);
+	if (!saved) {
+		LOG("Failed to save %s\n", output_file.c_str());
+	}
+
+	glDeleteRenderbuffers(1, &state.tile_colour_buffer);
+	glDeleteFramebuffers(1, &state.tile_framebuffer);
+
 	glfwDestroyWindow(window);
 	glfwTerminate();
 
-	exit(EXIT_SUCCESS);
+	exit(saved ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -0,0 +1,118 @@
+#ifndef _VECTORIZE_HPP_
+#define _VECTORIZE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <limits>
+
+#include "gene.hpp"
+#include "image_util.hpp"
+
+// Library interface to the solver, implemented in vectorize_lib.cpp.
+//
+// The solver is anytime: it keeps the best gene found so far, which is what
+// progress callbacks see and what is returned whenever the solver is stopped.
+
+struct VectorizeProgress
+{
+	double seconds;
+	long long iterations;
+	double fitness;
+
+	// Best gene so far, only valid for the duration of the callback.
+	int polygon_count;
+	const Poly *gene;
+};
+
+typedef void (*VectorizeProgressCallback)(const VectorizeProgress &progress, void *user_data);
+
+struct VectorizeOptions
+{
+	VectorizeOptions() : deadline(0), target_fitness(0), max_iterations(0), threads(1), seed(0),
+		memory_budget(512), gradient_interval(0), gradient_steps(20), progress(NULL), progress_interval(1), user_data(NULL), cancel(NULL) {}
+
+	// Each of these stops the solver when set, whichever is reached first.
+	double deadline;
+	float target_fitness;
+	long long max_iterations;
+
+	// Threads beyond the first score candidates in parallel, see Pipeline.
+	int threads;
+
+	// Runs with the same seed and single thread are reproducible.
+	unsigned int seed;
+
+	// In MB, split evenly between the source and composite tiles.
+	size_t memory_budget;
+
+	// Iterations between refining every polygon at once by gradient descent on
+	// |threads| threads, 0 to only use single polygon changes.
+	long long gradient_interval;
+	int gradient_steps;
+
+	// Called every |progress_interval| seconds from the calling thread.
+	VectorizeProgressCallback progress;
+	double progress_interval;
+	void *user_data;
+
+	// Stops the solver once set from any thread.
+	const std::atomic<bool> *cancel;
+};
+
+struct Gene
+{
+	Gene() : width(0), height(0), polygon_count(0), polygons(NULL),
+		fitness(std::numeric_limits<double>::max()), iterations(0) {}
+
+	~Gene() {
+		if (polygons)
+			delete[] polygons;
+	}
+
+	// |polygons| is owned, so genes can be moved but not copied.
+	Gene(const Gene&) = delete;
+	Gene &operator=(const Gene&) = delete;
+
+	Gene(Gene &&other) : width(other.width), height(other.height), polygon_count(other.polygon_count),
+		polygons(other.polygons), fitness(other.fitness), iterations(other.iterations) {
+		other.polygon_count = 0;
+		other.polygons = NULL;
+	}
+
+	Gene &operator=(Gene &&other) {
+		if (this != &other) {
+			if (polygons)
+				delete[] polygons;
+			width = other.width;
+			height = other.height;
+			polygon_count = other.polygon_count;
+			polygons = other.polygons;
+			fitness = other.fitness;
+			iterations = other.iterations;
+			other.polygon_count = 0;
+			other.polygons = NULL;
+		}
+		return *this;
+	}
+
+	unsigned int width;
+	unsigned int height;
+
+	int polygon_count;
+	Poly *polygons;
+
+	double fitness;
+	long long iterations;
+};
+
+// Polygonizes |image| into |gene| until one of the stopping conditions in |options| is met.
+// Creates its own hidden GLFW window for a GL context, so like the rest of GLFW it
+// must be called from the main thread. GLFW is initialized by the first call and left
+// initialized for later ones, so the application should call glfwTerminate() once it's
+// done with both GLFW and the solver. A later call initializes it again.
+// Returns false if the solver couldn't be set up, or if its tiles couldn't be mapped
+// part way, in which case |gene| is the best gene found at most |progress_interval|
+// seconds before that.
+bool Vectorize(const Image &image, const VectorizeOptions &options, Gene *gene);
+
+#endif
@@ -0,0 +1,154 @@
+#define GL_GLEXT_PROTOTYPES
+
+#define GLFW_DLL
+
+#define NOMINMAX
+#include <Windows.h>
+
+#include <GL/glew.h>
+#include <GLFW\glfw3.h>
+
+#include "solver.hpp"
+#include "vectorize.hpp"
+
+void CopyBestGene(const GeneImage &gene_image, Gene *gene) {
+	if (gene->polygons)
+		delete[] gene->polygons;
+
+	gene->polygon_count = gene_image.polygon_count;
+	gene->polygons = new Poly[gene_image.polygon_count];
+	CopyPolygons(gene->polygons, gene_image.gene, gene_image.polygon_count);
+	gene->fitness = gene_image.fitness;
+}
+
+bool ShouldStop(const VectorizeOptions &options, double seconds, long long iterations, double fitness) {
+	return (options.cancel && *options.cancel) ||
+		(options.deadline > 0 && seconds >= options.deadline) ||
+		(options.target_fitness > 0 && fitness <= options.target_fitness) ||
+		(options.max_iterations > 0 && iterations >= options.max_iterations);
+}
+
+bool Vectorize(const Image &image, const VectorizeOptions &options, Gene *gene) {
+	// A no-op after the first call, GLFW is left initialized, see vectorize.hpp.
+	if (!glfwInit()) {
+		LOG("Failed to initialize glfw\n");
+		return false;
+	}
+	double start = glfwGetTime();
+
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow *context = glfwCreateWindow(1, 1, "Vectorize", NULL, NULL);
+	if (!context) {
+		LOG("Failed to create window\n");
+		return false;
+	}
+	GLFWwindow *prev_context = glfwGetCurrentContext();
+	glfwMakeContextCurrent(context);
+
+	// The budget is split evenly between the source and composite.
+	size_t memory_budget = options.memory_budget * 1024 * 1024 / 2;
+
+	SimulationState state;
+	SeedState(state, options.seed);
+
+	Rect image_rect = { 0, 0, static_cast<int>(image.width), static_cast<int>(image.height) };
+	bool initialized = glewInit() == GLEW_OK &&
+		InitTiledImage(&state.source_image, image.width, image.height, image.channels, memory_budget);
+	if (initialized) {
+		initialized = WriteRect(&state.source_image, image_rect, image.data) &&
+			InitGeneImage(state, state.source_image, 3, 8, memory_budget, &state.gene_image) &&
+			glCreateFramebuffer(&state.tile_framebuffer, &state.tile_colour_buffer,
+				std::min(state.source_image.tile_size, image.width),
+				std::min(state.source_image.tile_size, image.height));
+	}
+	if (!initialized) {
+		glfwMakeContextCurrent(prev_context);
+		glfwDestroyWindow(context);
+		return false;
+	}
+	InitGLState();
+
+	gene->width = image.width;
+	gene->height = image.height;
+
+	// One thread renders and commits, the rest score.
+	int workers = std::max(0, options.threads - 1);
+	Pipeline pipeline;
+	if (workers > 0) {
+		StartPipeline(&pipeline, state, workers);
+	} else {
+		SyncComposite(state);
+	}
+	CopyBestGene(state.gene_image, gene);
+
+	// |gene| is only brought up to date with the best gene when a worse one may be accepted,
+	// when progress is reported and on return. |best_in_state| is set while it's behind.
+	double best_fitness = gene->fitness;
+	bool best_in_state = false;
+
+	float temperature = 1.0f;
+	double next_progress = options.progress_interval;
+	long long iterations = 0;
+	long long next_gradient = options.gradient_interval;
+	while (true) {
+		double seconds = glfwGetTime() - start;
+		if (seconds >= next_progress) {
+			// Even without a callback, as |state| can't be copied once its tiles failed.
+			if (best_in_state && !TilesFailed(state)) {
+				CopyBestGene(state.gene_image, gene);
+				best_in_state = false;
+			}
+			if (options.progress) {
+				VectorizeProgress progress;
+				progress.seconds = seconds;
+				progress.iterations = iterations;
+				progress.fitness = gene->fitness;
+				progress.polygon_count = gene->polygon_count;
+				progress.gene = gene->polygons;
+				options.progress(progress, options.user_data);
+			}
+			next_progress = seconds + options.progress_interval;
+		}
+		if (ShouldStop(options, seconds, iterations, best_fitness) || TilesFailed(state))
+			break;
+
+		// Annealing can accept worse genes, so the best one is copied out before it's replaced.
+		if (temperature > 0 && best_in_state) {
+			CopyBestGene(state.gene_image, gene);
+			best_in_state = false;
+		}
+
+		if (workers > 0) {
+			PipelineStep(&pipeline, state, temperature);
+			iterations = pipeline.total_scored;
+		} else {
+			UpdateAndRender(state, temperature, 0);
+			iterations = state.iterations;
+		}
+		temperature = 1.0f - 0.001f * iterations;
+
+		if (options.gradient_interval > 0 && iterations >= next_gradient) {
+			StopPipeline(&pipeline);
+			GradientRefine(state, options.gradient_steps, std::max(1, options.threads),
+				options.deadline > 0 ? start + options.deadline : 0, options.cancel);
+			if (workers > 0)
+				StartPipeline(&pipeline, state, workers);
+			next_gradient = iterations + options.gradient_interval;
+		}
+
+		if (state.gene_image.fitness < best_fitness && !TilesFailed(state)) {
+			best_fitness = state.gene_image.fitness;
+			best_in_state = true;
+		}
+	}
+	StopPipeline(&pipeline);
+	if (best_in_state && !TilesFailed(state))
+		CopyBestGene(state.gene_image, gene);
+	gene->iterations = iterations;
+
+	glDeleteRenderbuffers(1, &state.tile_colour_buffer);
+	glDeleteFramebuffers(1, &state.tile_framebuffer);
+	glfwMakeContextCurrent(prev_context);
+	glfwDestroyWindow(context);
+	return !TilesFailed(state);
+}
@@ -0,0 +1,142 @@
+#include <cstdlib>
+#include <vector>
+
+#include "gene_codec.hpp"
+#include "test_util.hpp"
+
+// Fills |gene| with |polygon_count| random polygons snapped to |encoding|.
+void RandomGene(int polygon_count, const GeneEncoding &encoding, Poly *gene) {
+	for (int i = 0; i < polygon_count; ++i) {
+		Poly &polygon = gene[i];
+		polygon.colour.r = rand() / static_cast<float>(RAND_MAX);
+		polygon.colour.g = rand() / static_cast<float>(RAND_MAX);
+		polygon.colour.b = rand() / static_cast<float>(RAND_MAX);
+		polygon.colour.a = rand() / static_cast<float>(RAND_MAX);
+		polygon.vertex_count = 3 + rand() % 8;
+		polygon.vertices = new Vertex[polygon.vertex_count];
+		for (int j = 0; j < polygon.vertex_count; ++j) {
+			polygon.vertices[j].x = rand() / static_cast<float>(RAND_MAX);
+			polygon.vertices[j].y = rand() / static_cast<float>(RAND_MAX);
+		}
+	}
+	QuantizeGene(gene, polygon_count, encoding);
+}
+
+bool SamePolygon(const Poly &p1, const Poly &p2) {
+	if (p1.vertex_count != p2.vertex_count || p1.colour.r != p2.colour.r || p1.colour.g != p2.colour.g ||
+		p1.colour.b != p2.colour.b || p1.colour.a != p2.colour.a) {
+		return false;
+	}
+	for (int i = 0; i < p1.vertex_count; ++i) {
+		if (p1.vertices[i].x != p2.vertices[i].x || p1.vertices[i].y != p2.vertices[i].y)
+			return false;
+	}
+	return true;
+}
+
+bool Decodes(const std::vector<uint8_t> &data, size_t size) {
+	unsigned int width, height;
+	int polygon_count;
+	Poly *gene;
+	if (!DecodeGene(data.data(), size, &width, &height, &polygon_count, &gene))
+		return false;
+	delete[] gene;
+	return true;
+}
+
+// A quantized gene decodes to exactly the gene which was encoded.
+void TestRoundTrip(const GeneEncoding &encoding) {
+	const int kPolygons = 20;
+	Poly gene[kPolygons];
+	RandomGene(kPolygons, encoding, gene);
+
+	std::vector<uint8_t> data;
+	EncodeGene(gene, kPolygons, 640, 480, encoding, &data);
+
+	unsigned int width = 0, height = 0;
+	int polygon_count = 0;
+	Poly *decoded = NULL;
+	CHECK(DecodeGene(data.data(), data.size(), &width, &height, &polygon_count, &decoded));
+	if (!decoded)
+		return;
+
+	CHECK(width == 640);
+	CHECK(height == 480);
+	CHECK(polygon_count == kPolygons);
+	for (int i = 0; i < kPolygons && i < polygon_count; ++i) {
+		CHECK(SamePolygon(gene[i], decoded[i]));
+	}
+	delete[] decoded;
+}
+
+// Every truncation of a valid gene is rejected.
+void TestTruncated(const GeneEncoding &encoding) {
+	const int kPolygons = 5;
+	Poly gene[kPolygons];
+	RandomGene(kPolygons, encoding, gene);
+
+	std::vector<uint8_t> data;
+	EncodeGene(gene, kPolygons, 64, 64, encoding, &data);
+	for (size_t size = 0; size < data.size(); ++size) {
+		CHECK(!Decodes(data, size));
+	}
+	CHECK(Decodes(data, data.size()));
+}
+
+void TestCorrupt() {
+	GeneEncoding encoding;
+	encoding.delta = true;
+	Poly polygon;
+	polygon.colour.r = polygon.colour.g = polygon.colour.b = polygon.colour.a = 1;
+	polygon.vertex_count = 3;
+	polygon.vertices = new Vertex[3];
+	polygon.vertices[0].x = polygon.vertices[0].y = 0;
+	polygon.vertices[1].x = 1;
+	polygon.vertices[1].y = 0;
+	polygon.vertices[2].x = polygon.vertices[2].y = 1;
+
+	std::vector<uint8_t> data;
+	EncodeGene(&polygon, 1, 64, 64, encoding, &data);
+	CHECK(Decodes(data, data.size()));
+
+	std::vector<uint8_t> corrupt = data;
+	corrupt[0] = 'X';
+	CHECK(!Decodes(corrupt, corrupt.size()));
+
+	corrupt = data;
+	corrupt[2] = kGeneVersion + 1;
+	CHECK(!Decodes(corrupt, corrupt.size()));
+
+	corrupt = data;
+	corrupt[4] = kMaxVertexBits + 1;
+	CHECK(!Decodes(corrupt, corrupt.size()));
+
+	// The magic, version, flags and bits, then one byte varints for the size and polygon count,
+	// the colour and the vertex count. The first vertex is at the origin so its x is one byte.
+	const size_t kFirstVertex = 5 + 3 + 4 + 1;
+	CHECK(data[kFirstVertex] == ZigZag(0));
+	corrupt = data;
+	corrupt[kFirstVertex] = static_cast<uint8_t>(ZigZag(-1));
+	CHECK(!Decodes(corrupt, corrupt.size()));
+
+	// A polygon count far beyond what the data holds fails before allocating it.
+	std::vector<uint8_t> huge(data.begin(), data.begin() + 7);
+	WriteVarint(0xFFFFFFFF, &huge);
+	huge.insert(huge.end(), data.begin() + 8, data.end());
+	CHECK(!Decodes(huge, huge.size()));
+}
+
+int main() {
+	srand(1);
+	for (int bits = kMinVertexBits; bits <= kMaxVertexBits; ++bits) {
+		for (int delta = 0; delta < 2; ++delta) {
+			GeneEncoding encoding;
+			encoding.vertex_bits = bits;
+			encoding.delta = delta != 0;
+			TestRoundTrip(encoding);
+			TestTruncated(encoding);
+		}
+	}
+	TestCorrupt();
+	return test_failures;
+}
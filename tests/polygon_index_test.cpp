@@ -0,0 +1,67 @@
+#include <cstdlib>
+#include <vector>
+
+#include "polygon_index.hpp"
+#include "test_util.hpp"
+
+const int kWidth = 640;
+const int kHeight = 480;
+
+// A random rect within the image, sometimes empty.
+Rect RandomRect() {
+	Rect rect;
+	rect.left = rand() % kWidth;
+	rect.bottom = rand() % kHeight;
+	rect.right = std::min(kWidth, rect.left + rand() % 200);
+	rect.top = std::min(kHeight, rect.bottom + rand() % 200);
+	return rect;
+}
+
+// Random appends, removals, updates and swaps give the same queries as checking every polygon.
+void TestAgainstBruteForce() {
+	PolygonIndex index;
+	InitPolygonIndex(&index, kWidth, kHeight);
+	std::vector<Rect> gene;
+
+	std::vector<int> polygons;
+	for (int step = 0; step < 20000; ++step) {
+		int count = static_cast<int>(gene.size());
+		int operation = rand() % 4;
+		if (count < 2 || operation == 0) {
+			Rect bounds = RandomRect();
+			AppendPolygonIndex(&index, bounds);
+			gene.push_back(bounds);
+		} else if (operation == 1) {
+			int polygon = rand() % count;
+			RemovePolygonIndex(&index, polygon);
+			gene.erase(gene.begin() + polygon);
+		} else if (operation == 2) {
+			int polygon = rand() % count;
+			Rect bounds = RandomRect();
+			UpdatePolygonIndex(&index, polygon, bounds);
+			gene[polygon] = bounds;
+		} else {
+			int polygon1 = rand() % count;
+			int polygon2 = rand() % count;
+			SwapPolygonIndex(&index, polygon1, polygon2);
+			std::swap(gene[polygon1], gene[polygon2]);
+		}
+
+		Rect query = RandomRect();
+		QueryPolygonIndex(&index, query, &polygons);
+		std::vector<int> expected;
+		for (size_t i = 0; i < gene.size(); ++i) {
+			if (!IsEmpty(IntersectRect(gene[i], query)))
+				expected.push_back(static_cast<int>(i));
+		}
+		CHECK(polygons == expected);
+		if (polygons != expected)
+			return;
+	}
+}
+
+int main() {
+	srand(1);
+	TestAgainstBruteForce();
+	return test_failures;
+}
@@ -0,0 +1,99 @@
+#include <cstdlib>
+#include <vector>
+
+#include "residual_map.hpp"
+#include "test_util.hpp"
+
+const int kSamples = 100000;
+
+// A residual map of |cells| cells in a row with the given errors, one pixel per cell.
+void InitRow(ResidualMap *map, const double *errors, int cells) {
+	map->cells_x = cells;
+	map->cells_y = 1;
+	map->error = new double[cells];
+	map->error_tree = new double[cells + 1];
+	for (int i = 0; i < cells; ++i) {
+		map->error[i] = errors[i];
+	}
+	BuildErrorTree(map);
+}
+
+// Fraction of samples which landed in each cell.
+std::vector<double> SampleCells(ResidualMap *map, const TiledImage &image) {
+	std::vector<double> counts(map->cells_x, 0);
+	for (int i = 0; i < kSamples; ++i) {
+		float x, y;
+		SampleResidual(map, image, &x, &y);
+		int cell = std::min(map->cells_x - 1, static_cast<int>(x * map->cells_x));
+		counts[cell] += 1.0 / kSamples;
+	}
+	return counts;
+}
+
+// Cells are sampled in proportion to their error, also after updating single cells.
+void TestProportional() {
+	const double kErrors[] = { 1, 0, 3, 4 };
+	ResidualMap map;
+	InitRow(&map, kErrors, 4);
+	TiledImage image;
+	image.width = 4;
+	image.height = 1;
+
+	std::vector<double> counts = SampleCells(&map, image);
+	CHECK_NEAR(counts[0], 1.0 / 8, 0.01);
+	CHECK(counts[1] == 0);
+	CHECK_NEAR(counts[2], 3.0 / 8, 0.01);
+	CHECK_NEAR(counts[3], 4.0 / 8, 0.01);
+
+	map.error[1] += 2;
+	AddTreeError(&map, 1, 2);
+	counts = SampleCells(&map, image);
+	CHECK_NEAR(counts[0], 1.0 / 10, 0.01);
+	CHECK_NEAR(counts[1], 2.0 / 10, 0.01);
+	CHECK_NEAR(counts[2], 3.0 / 10, 0.01);
+	CHECK_NEAR(counts[3], 4.0 / 10, 0.01);
+}
+
+// Without any error every cell is as likely.
+void TestUniform() {
+	const double kErrors[] = { 0, 0, 0, 0, 0 };
+	ResidualMap map;
+	InitRow(&map, kErrors, 5);
+	TiledImage image;
+	image.width = 5;
+	image.height = 1;
+
+	std::vector<double> counts = SampleCells(&map, image);
+	for (int i = 0; i < 5; ++i) {
+		CHECK_NEAR(counts[i], 1.0 / 5, 0.01);
+	}
+}
+
+// Sampling within a rect only picks its cells, in proportion to their error.
+void TestRect() {
+	const double kErrors[] = { 100, 1, 3, 100 };
+	ResidualMap map;
+	InitRow(&map, kErrors, 4);
+	TiledImage image;
+	image.width = 4;
+	image.height = 1;
+
+	std::vector<double> counts(4, 0);
+	for (int i = 0; i < kSamples; ++i) {
+		float x, y;
+		SampleResidualRect(map, 1, 0, 3, 1, image, &x, &y);
+		counts[std::min(3, static_cast<int>(x * 4))] += 1.0 / kSamples;
+	}
+	CHECK(counts[0] == 0);
+	CHECK_NEAR(counts[1], 1.0 / 4, 0.01);
+	CHECK_NEAR(counts[2], 3.0 / 4, 0.01);
+	CHECK(counts[3] == 0);
+}
+
+int main() {
+	srand(1);
+	TestProportional();
+	TestUniform();
+	TestRect();
+	return test_failures;
+}
@@ -0,0 +1,103 @@
+#include <cstdlib>
+#include <vector>
+
+#include "soft_raster.hpp"
+#include "test_util.hpp"
+
+const int kWidth = 20;
+const int kHeight = 16;
+
+void SetPolygon(Poly *polygon, float r, float g, float b, float a, const float *coordinates, int count) {
+	polygon->colour.r = r;
+	polygon->colour.g = g;
+	polygon->colour.b = b;
+	polygon->colour.a = a;
+	polygon->vertex_count = count;
+	polygon->vertices = new Vertex[count];
+	for (int i = 0; i < count; ++i) {
+		polygon->vertices[i].x = coordinates[i * 2];
+		polygon->vertices[i].y = coordinates[i * 2 + 1];
+	}
+}
+
+// The parameter at |parameter| in the layout of SoftPolygon::first_parameter.
+float *Parameter(Poly *gene, const SoftScene &scene, int parameter) {
+	int i = static_cast<int>(scene.polygons.size()) - 1;
+	while (scene.polygons[i].first_parameter > parameter)
+		--i;
+	Poly &polygon = gene[i];
+	int offset = parameter - scene.polygons[i].first_parameter;
+	float *colour[4] = { &polygon.colour.r, &polygon.colour.g, &polygon.colour.b, &polygon.colour.a };
+	if (offset < 4)
+		return colour[offset];
+	Vertex &vertex = polygon.vertices[(offset - 4) / 2];
+	return offset % 2 == 0 ? &vertex.x : &vertex.y;
+}
+
+double SoftError(const Poly *gene, int polygon_count, const SoftImage &source) {
+	SoftScene scene;
+	SoftGradient gradient;
+	BuildSoftScene(gene, polygon_count, source.width, source.height, &scene);
+	ComputeSoftGradient(scene, source, 1, &gradient);
+	return gradient.error;
+}
+
+// The analytic gradient matches central differences of the error for every colour, alpha
+// and vertex. Small steps keep the convex polygons' triangulations, so the error is smooth.
+void TestFiniteDifferences(int threads) {
+	const float kQuad[] = { 0.12f, 0.17f, 0.71f, 0.09f, 0.83f, 0.66f, 0.23f, 0.78f };
+	const float kTriangle[] = { 0.41f, 0.33f, 0.93f, 0.46f, 0.57f, 0.94f };
+	const int kPolygons = 2;
+	Poly gene[kPolygons];
+	SetPolygon(&gene[0], 0.8f, 0.3f, 0.1f, 0.7f, kQuad, 4);
+	SetPolygon(&gene[1], 0.2f, 0.6f, 0.9f, 0.5f, kTriangle, 3);
+
+	SoftImage source;
+	source.width = kWidth;
+	source.height = kHeight;
+	source.channels = 3;
+	source.data.resize(kWidth * kHeight * 3);
+	for (size_t i = 0; i < source.data.size(); ++i) {
+		source.data[i] = rand() / static_cast<float>(RAND_MAX);
+	}
+
+	SoftScene scene;
+	SoftGradient gradient;
+	BuildSoftScene(gene, kPolygons, kWidth, kHeight, &scene);
+	ComputeSoftGradient(scene, source, threads, &gradient);
+	CHECK_NEAR(gradient.error, SoftError(gene, kPolygons, source), 1e-3);
+
+	const float kStep = 1e-3f;
+	for (int p = 0; p < scene.parameter_count; ++p) {
+		float *value = Parameter(gene, scene, p);
+		float original = *value;
+
+		*value = original + kStep;
+		for (int i = 0; i < kPolygons; ++i) {
+			InvalidateTriangulation(gene[i]);
+		}
+		double plus = SoftError(gene, kPolygons, source);
+
+		*value = original - kStep;
+		for (int i = 0; i < kPolygons; ++i) {
+			InvalidateTriangulation(gene[i]);
+		}
+		double minus = SoftError(gene, kPolygons, source);
+
+		*value = original;
+		for (int i = 0; i < kPolygons; ++i) {
+			InvalidateTriangulation(gene[i]);
+		}
+
+		double numeric = (plus - minus) / (2 * kStep);
+		double analytic = gradient.parameters[p];
+		CHECK_NEAR(analytic, numeric, 0.05 * std::max(std::fabs(analytic), std::fabs(numeric)) + 0.05);
+	}
+}
+
+int main() {
+	srand(1);
+	TestFiniteDifferences(1);
+	TestFiniteDifferences(3);
+	return test_failures;
+}
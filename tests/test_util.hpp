@@ -0,0 +1,28 @@
+#ifndef _TEST_UTIL_HPP_
+#define _TEST_UTIL_HPP_
+
+#include <cmath>
+#include <cstdio>
+
+// Minimal checks for the tests in this directory. Each test is its own executable
+// which reports every failed check and exits with the number of failures.
+
+static int test_failures = 0;
+
+#define CHECK(condition) do { \
+	if (!(condition)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+		test_failures += 1; \
+	} \
+} while (0)
+
+#define CHECK_NEAR(a, b, tolerance) do { \
+	double check_a = (a), check_b = (b); \
+	if (!(std::fabs(check_a - check_b) <= (tolerance))) { \
+		fprintf(stderr, "%s:%d: CHECK_NEAR(%s, %s) failed, %g vs %g\n", __FILE__, __LINE__, #a, #b, \
+			check_a, check_b); \
+		test_failures += 1; \
+	} \
+} while (0)
+
+#endif
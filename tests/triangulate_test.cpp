@@ -0,0 +1,156 @@
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "triangulate.hpp"
+#include "test_util.hpp"
+
+void SetOutline(Poly *polygon, const float *coordinates, int count) {
+	if (polygon->vertices)
+		delete[] polygon->vertices;
+	polygon->vertex_count = count;
+	polygon->vertices = new Vertex[count];
+	for (int i = 0; i < count; ++i) {
+		polygon->vertices[i].x = coordinates[i * 2];
+		polygon->vertices[i].y = coordinates[i * 2 + 1];
+	}
+	InvalidateTriangulation(*polygon);
+}
+
+// Whether the triangles are counter clockwise and no point of a grid is strictly inside two of them.
+bool TrianglesDisjoint(const Poly &polygon) {
+	for (int i = 0; i < polygon.triangle_count; ++i) {
+		const Vertex *v = polygon.triangles + i * 3;
+		if (Cross(v[0], v[1], v[2]) <= 0)
+			return false;
+	}
+
+	const int kGrid = 97;
+	for (int gy = 0; gy < kGrid; ++gy) {
+		for (int gx = 0; gx < kGrid; ++gx) {
+			Vertex p = { (gx + 0.5f) / kGrid, (gy + 0.5f) / kGrid };
+			int inside = 0;
+			for (int i = 0; i < polygon.triangle_count; ++i) {
+				const Vertex *v = polygon.triangles + i * 3;
+				inside += Cross(v[0], v[1], p) > 0 && Cross(v[1], v[2], p) > 0 && Cross(v[2], v[0], p) > 0;
+			}
+			if (inside > 1)
+				return false;
+		}
+	}
+	return true;
+}
+
+void TestConvex() {
+	// Clockwise, which is triangulated counter clockwise all the same.
+	const float kSquare[] = { 0.25f, 0.25f, 0.25f, 0.75f, 0.75f, 0.75f, 0.75f, 0.25f };
+	Poly polygon;
+	SetOutline(&polygon, kSquare, 4);
+	Triangulate(polygon);
+	CHECK(polygon.triangle_count == 2);
+	CHECK_NEAR(polygon.area, 0.25, 1e-6);
+	CHECK(TrianglesDisjoint(polygon));
+	CHECK_NEAR(polygon.min.x, 0.25, 1e-6);
+	CHECK_NEAR(polygon.max.y, 0.75, 1e-6);
+}
+
+void TestConcave() {
+	// An L shape, whose convex hull would cover the notch.
+	const float kL[] = { 0, 0, 1, 0, 1, 0.5f, 0.5f, 0.5f, 0.5f, 1, 0, 1 };
+	Poly polygon;
+	SetOutline(&polygon, kL, 6);
+	CHECK(IsSimple(polygon.vertices, polygon.vertex_count));
+	Triangulate(polygon);
+	CHECK(polygon.triangle_count == 4);
+	CHECK_NEAR(polygon.area, 0.75, 1e-6);
+	CHECK(TrianglesDisjoint(polygon));
+
+	// Two triangles touching at a point, which appears twice in the outline.
+	const float kPinched[] = { 0, 0, 1, 0, 0.5f, 0.5f, 1, 1, 0, 1, 0.5f, 0.5f };
+	SetOutline(&polygon, kPinched, 6);
+	Triangulate(polygon);
+	CHECK_NEAR(polygon.area, 0.5, 1e-6);
+	CHECK(TrianglesDisjoint(polygon));
+}
+
+void TestSelfIntersecting() {
+	// A bow tie, which is replaced by its convex hull.
+	const float kBowTie[] = { 0, 0, 1, 1, 1, 0, 0, 1 };
+	Poly polygon;
+	SetOutline(&polygon, kBowTie, 4);
+	CHECK(!IsSimple(polygon.vertices, polygon.vertex_count));
+	Triangulate(polygon);
+	CHECK(polygon.triangle_count == 2);
+	CHECK_NEAR(polygon.area, 1, 1e-6);
+	CHECK(TrianglesDisjoint(polygon));
+}
+
+// Random star shaped outlines, which are simple, cover exactly their own area.
+void TestRandomStars() {
+	for (int i = 0; i < 200; ++i) {
+		int count = 3 + rand() % 60;
+		std::vector<float> coordinates(count * 2);
+		for (int j = 0; j < count; ++j) {
+			float angle = 6.2831853f * (j + 0.8f * rand() / RAND_MAX) / count;
+			float radius = 0.05f + 0.4f * rand() / RAND_MAX;
+			coordinates[j * 2] = 0.5f + radius * std::cos(angle);
+			coordinates[j * 2 + 1] = 0.5f + radius * std::sin(angle);
+		}
+
+		Poly polygon;
+		SetOutline(&polygon, coordinates.data(), count);
+		CHECK(IsSimple(polygon.vertices, polygon.vertex_count));
+		Triangulate(polygon);
+		CHECK(polygon.triangle_count == count - 2);
+		CHECK_NEAR(polygon.area, std::fabs(SignedArea(polygon.vertices, count)), 1e-5);
+		CHECK(TrianglesDisjoint(polygon));
+	}
+}
+
+// The largest outlines the solver allows are ear clipped rather than replaced by their hull.
+void TestLargeOutline() {
+	const int kCount = 1024;
+	std::vector<float> coordinates(kCount * 2);
+	for (int i = 0; i < kCount; ++i) {
+		float angle = 6.2831853f * i / kCount;
+		float radius = i % 2 ? 0.45f : 0.2f;
+		coordinates[i * 2] = 0.5f + radius * std::cos(angle);
+		coordinates[i * 2 + 1] = 0.5f + radius * std::sin(angle);
+	}
+
+	Poly polygon;
+	SetOutline(&polygon, coordinates.data(), kCount);
+	Triangulate(polygon);
+	CHECK(polygon.triangle_count == kCount - 2);
+	CHECK_NEAR(polygon.area, std::fabs(SignedArea(polygon.vertices, kCount)), 1e-4);
+}
+
+void TestMoveTriangulation() {
+	const float kSquare[] = { 0.25f, 0.25f, 0.75f, 0.25f, 0.75f, 0.75f, 0.25f, 0.75f };
+	Poly polygon;
+	SetOutline(&polygon, kSquare, 4);
+	Triangulate(polygon);
+
+	polygon.vertices[2].x = 0.8f;
+	CHECK(MoveTriangulation(polygon));
+	CHECK(polygon.triangulated);
+	CHECK_NEAR(polygon.max.x, 0.8, 1e-6);
+	CHECK_NEAR(polygon.area, std::fabs(SignedArea(polygon.vertices, 4)), 1e-6);
+
+	// Pulling a corner across the opposite diagonal flips a triangle.
+	polygon.vertices[2].x = 0.1f;
+	polygon.vertices[2].y = 0.1f;
+	CHECK(!MoveTriangulation(polygon));
+	CHECK(!polygon.triangulated);
+}
+
+int main() {
+	srand(1);
+	TestConvex();
+	TestConcave();
+	TestSelfIntersecting();
+	TestRandomStars();
+	TestLargeOutline();
+	TestMoveTriangulation();
+	return test_failures;
+}